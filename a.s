@@ -0,0 +1,90 @@
+.intel_syntax noprefix
+.global f
+f:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 8
+  mov [rbp-8], rdi
+  lea rax, [rbp-8]
+  push rax
+  pop rax
+  mov rax, [rax]
+  push rax
+  push 3
+  pop rdi
+  pop rax
+  cmp rax, rdi
+  setl al
+  movzb rax, al
+  push rax
+  pop rax
+  cmp rax, 0
+  je  .Lelse.f.0
+  push 1
+  pop rax
+  jmp .Lreturn.f
+  jmp .Lend.f.0
+.Lelse.f.0:
+  push 2
+  pop rax
+  jmp .Lreturn.f
+.Lend.f.0:
+.Lreturn.f:
+  mov rsp, rbp
+  pop rbp
+  ret
+.global g
+g:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 0
+  push 5
+  pop rax
+  jmp .Lreturn.g
+.Lreturn.g:
+  mov rsp, rbp
+  pop rbp
+  ret
+.global main
+main:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 0
+  push 1
+  pop rdi
+  mov rax, rsp
+  and rax, 15
+  jnz .Lcall.main.0
+  mov rax, 0
+  call f
+  jmp .Lend.main.0
+.Lcall.main.0:
+  sub rsp, 8
+  mov rax, 0
+  call f
+  add rsp, 8
+.Lend.main.0:
+  push rax
+  mov rax, rsp
+  and rax, 15
+  jnz .Lcall.main.1
+  mov rax, 0
+  call g
+  jmp .Lend.main.1
+.Lcall.main.1:
+  sub rsp, 8
+  mov rax, 0
+  call g
+  add rsp, 8
+.Lend.main.1:
+  push rax
+  pop rdi
+  pop rax
+  add rax, rdi
+  push rax
+  pop rax
+  jmp .Lreturn.main
+.Lreturn.main:
+  mov rsp, rbp
+  pop rbp
+  ret
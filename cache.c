@@ -0,0 +1,120 @@
+#include "chibicc.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Per-function output cache (--cache-dir).
+//
+// Each function's assembly is stored in <dir>/<key>.s, where the key
+// hashes the function's tokens together with the compiler binary and
+// every option that changes the generated code. Labels are local to
+// their function, so cached text can be spliced into any output.
+
+// Cache directory, or NULL if caching is disabled
+char *cache_dir;
+
+// Hash of the compiler and its code generation options
+uint64_t cache_seed;
+
+// 64-bit FNV-1a
+uint64_t fnv1a(uint64_t h, void *p, int len) {
+  unsigned char *s = p;
+  for (int i = 0; i < len; i++) {
+    h ^= s[i];
+    h *= 0x100000001b3;
+  }
+  return h;
+}
+
+void cache_init(char *dir) {
+  cache_dir = dir;
+  mkdir(dir, 0777);
+
+  // Hash the compiler binary itself so that a rebuilt compiler
+  // never reuses stale output.
+  uint64_t h = 0xcbf29ce484222325;
+  FILE *fp = fopen("/proc/self/exe", "rb");
+  if (fp) {
+    char buf[65536];
+    int len;
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+      h = fnv1a(h, buf, len);
+    fclose(fp);
+  }
+
+  // Every option that changes the generated code must be mixed in here.
+  h = fnv1a(h, &opt_instrument, sizeof(opt_instrument));
+  h = fnv1a(h, &opt_profile_generate, sizeof(opt_profile_generate));
+  h = fnv1a(h, &opt_cse, sizeof(opt_cse));
+  h = fnv1a(h, &opt_if_convert, sizeof(opt_if_convert));
+  cache_seed = h;
+}
+
+// Returns the key of the function spanning tokens start..end.
+uint64_t function_key(Token *start, Token *end, char *name) {
+  uint64_t h = cache_seed;
+  for (Token *tok = start;; tok++) {
+    h = fnv1a(h, &tok->kind, sizeof(tok->kind));
+    h = fnv1a(h, &tok->len, sizeof(tok->len));
+    h = fnv1a(h, tok->str, tok->len);
+    if (tok == end)
+      break;
+  }
+  return hash_profile(h, name);
+}
+
+char *cache_path(uint64_t key, char *suffix) {
+  int len = strlen(cache_dir) + 40;
+  char *path = malloc(len);
+  snprintf(path, len, "%s/%016llx%s", cache_dir, (unsigned long long)key,
+           suffix);
+  return path;
+}
+
+// Returns the cached assembly for `key`, or NULL on a miss.
+char *cache_lookup(uint64_t key) {
+  char *path = cache_path(key, ".s");
+  FILE *fp = fopen(path, "rb");
+  free(path);
+  if (!fp) {
+    stats.cache_misses++;
+    return NULL;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  long len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *buf = malloc(len + 1);
+  stats.bytes += len + 1;
+  if (fread(buf, 1, len, fp) != len) {
+    fclose(fp);
+    free(buf);
+    stats.cache_misses++;
+    return NULL;
+  }
+  buf[len] = '\0';
+  fclose(fp);
+
+  stats.cache_hits++;
+  return buf;
+}
+
+// Stores `data` under `key`. The file is written under a temporary
+// name and renamed so that concurrent compilers never see a partial
+// entry. Failing to write the cache is not an error.
+void cache_store(uint64_t key, char *data, int len) {
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".tmp%d", (int)getpid());
+  char *tmp = cache_path(key, suffix);
+  char *path = cache_path(key, ".s");
+
+  FILE *fp = fopen(tmp, "wb");
+  if (fp) {
+    bool ok = fwrite(data, 1, len, fp) == len;
+    if (fclose(fp) == 0 && ok)
+      rename(tmp, path);
+    else
+      remove(tmp);
+  }
+  free(tmp);
+  free(path);
+}
@@ -1,10 +1,33 @@
 #include <ctype.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+//
+// main.c
+//
+
+// Counters reported by --stats. They are bumped unconditionally by
+// the allocation sites, which is just an add, so they cost next to
+// nothing when --stats is off.
+typedef struct Stats Stats;
+struct Stats {
+  long tokens; // Tokens created
+  long nodes;  // AST nodes created
+  long vars;   // Local variables created
+  long funcs;  // Functions created
+  long bytes;  // Bytes allocated
+
+  long cache_hits;   // Functions taken from the cache
+  long cache_misses; // Functions compiled and stored to the cache
+};
+
+extern _Thread_local Stats stats;
+
 //
 // tokenize.c
 //
@@ -17,32 +40,90 @@ typedef enum {
   TK_EOF,      // End-of-file markers
 } TokenKind;
 
+// Keywords and punctuators. The lexer gives every TK_RESERVED token
+// one of these ids so that the parser never compares strings.
+typedef enum {
+  KW_RETURN, // "return"
+  KW_IF,     // "if"
+  KW_ELSE,   // "else"
+  KW_WHILE,  // "while"
+  KW_FOR,    // "for"
+  KW_INT,    // "int"
+  PU_EQ,     // ==
+  PU_NE,     // !=
+  PU_LE,     // <=
+  PU_GE,     // >=
+  PU_ADD,    // +
+  PU_SUB,    // -
+  PU_MUL,    // *
+  PU_DIV,    // /
+  PU_LPAREN, // (
+  PU_RPAREN, // )
+  PU_LT,     // <
+  PU_GT,     // >
+  PU_SEMI,   // ;
+  PU_ASSIGN, // =
+  PU_LBRACE, // {
+  PU_RBRACE, // }
+  PU_COMMA,  // ,
+  PU_AMP,    // &
+  NUM_RESERVED,
+} Reserved;
+
 // Token type
+//
+// Tokens are stored contiguously in `tokens` rather than linked to each
+// other, so the parser walks them with an index and can look ahead or
+// back by plain arithmetic. The fields are kept together (rather than
+// split into one array per field) because consume() and expect() read
+// all of them at once.
 typedef struct Token Token;
 struct Token {
   TokenKind kind; // Token kind
-  Token *next;    // Next token
+  Reserved id;    // If kind is TK_RESERVED, which one
+  int len;        // Token length
   int val;        // If kind is TK_NUM, its value
   char *str;      // Token string
-  int len;        // Token length
 };
 
 void error(char *fmt, ...);
 void error_at(char *loc, char *fmt, ...);
 void error_tok(Token *tok, char *fmt, ...);
-Token *consume(char *op);
+Token *peek();
+Token *consume(Reserved id);
 char *strndup(char *p, int len);
 Token *consume_ident();
-void expect(char *op);
+void expect(Reserved id);
 int expect_number();
 char *expect_ident();
 Token *expect_ident_tok();
 bool at_eof();
-Token *new_token(TokenKind kind, Token *cur, char *str, int len);
+Token *new_token(TokenKind kind, char *str, int len);
 Token *tokenize();
+Token *tokenize_range(char *p, char *end);
+
+// The front end's state is thread-local so that functions can be
+// tokenized and parsed on several threads (see parallel.c).
+extern char *user_input;               // Input program
+extern _Thread_local Token *tokens;    // Token array, terminated by a TK_EOF token
+extern _Thread_local uint32_t tokpos;  // Index of the current token
+extern _Thread_local jmp_buf *error_jmp;
+
+//
+// type.c
+//
 
-extern char *user_input; // Input program
-extern Token *token; // Current token
+typedef uint16_t TypeId;
+
+enum {
+  TY_NONE, // Statements have no type
+  TY_INT,  // int; pointers to int follow
+};
+
+bool is_pointer(TypeId ty);
+TypeId pointer_to(TypeId base);
+TypeId base_type(TypeId ty);
+int size_of(TypeId ty);
 
 //
 // parse.c
@@ -51,8 +132,10 @@ extern Token *token; // Current token
 // Local variable
 typedef struct Var Var;
 struct Var {
-  char *name; // Variable name
-  int offset; // Offset from RBP
+  char *name;  // Variable name
+  TypeId ty;   // Type
+  int offset;  // Offset from RBP
+  int version; // Bumped on every assignment by optimize.c
 };
 
 typedef struct VarList VarList;
@@ -84,34 +167,81 @@ typedef enum {
   ND_VAR,       // Variable
   ND_NUM,       // Integer
   ND_NULL,      // do nothing
+  ND_SELECT,    // cond ? then : els, made by if-conversion
 } NodeKind;
 
 // AST node type (抽象構文木のノードの型)
+//
+// Nodes live in a per-function NodePool and refer to each other by
+// 32-bit index, so a node is 16 bytes and a function's tree is one
+// contiguous array. Expressions carry their type in `ty`. The meaning
+// of the operands depends on the kind:
+//
+//   binary operators, ND_ASSIGN         lhs, rhs
+//   ND_ADDR, ND_DEREF, ND_RETURN,
+//   ND_EXPR_STMT                        lhs
+//   ND_NUM                              val
+//   ND_VAR                              var
+//   ND_IF                               lhs = cond, extra[rhs] = then,
+//                                       extra[rhs+1] = els
+//   ND_SELECT                           lhs = cond, extra[rhs] = then,
+//                                       extra[rhs+1] = els
+//   ND_WHILE                            lhs = cond, rhs = then
+//   ND_FOR                              extra[rhs..rhs+3] = init, cond,
+//                                       inc, then
+//   ND_BLOCK                            extra[lhs..lhs+rhs-1] = body
+//   ND_FUNCALL                          extra[lhs..lhs+rhs-1] = args;
+//                                       the function name is the token
+//                                       at `loc`
+//
+// Missing optional children (e.g. the parts of "for (;;)") are 0.
+typedef uint32_t NodeId;
+
 typedef struct Node Node;
 struct Node {
-  NodeKind kind; // Node kind
-  Node *next;    // Next node
-  Token *tok;    // Representative token
-
-  Node *lhs;     // Left-hand side
-  Node *rhs;     // Right-hand side
+  uint8_t kind; // Node kind
+  TypeId ty;    // Type, or TY_NONE for statements
+  uint32_t loc; // Offset of the representative token in user_input
+  union {
+    struct {
+      NodeId lhs;
+      NodeId rhs;
+    };
+    int val;  // Used if kind == ND_NUM
+    Var *var; // Used if kind == ND_VAR
+  };
+};
 
-  // "if", "while" or "for" statement
-  Node *cond;
-  Node *then;
-  Node *els;     // Used if kind == ND_IF
-  Node *init;    // Used if kind == ND_FOR
-  Node *inc;     // Used if kind == ND_FOR
+typedef struct NodePool NodePool;
+struct NodePool {
+  Node *nodes; // nodes[0] is a ND_NULL node that stands for "none"
+  int len;
+  int capa;
 
-  // Block
-  Node *body;
+  NodeId *extra; // Child lists of ND_IF, ND_FOR, ND_BLOCK and ND_FUNCALL
+  int extra_len;
+  int extra_capa;
+};
 
-  // Function call
-  char *funcname;
-  Node *args;
+// Optimization remark attached to a function (see remarks.c)
+typedef struct Remark Remark;
+struct Remark {
+  Remark *next;
+  uint32_t loc; // Offset in user_input
+  char *msg;
+};
 
-  Var *var;      // Used if kind == ND_VAR
-  int val;       // Used if kind == ND_NUM
+// What the generated assembly of a function consists of
+typedef struct CodeMetrics CodeMetrics;
+struct CodeMetrics {
+  int frame_size;
+  int insns;
+  int pushpop;
+  int loads;
+  int stores;
+  int branches;
+  int calls;
+  int labels;
 };
 
 typedef struct Function Function;
@@ -120,15 +250,90 @@ struct Function {
   char *name;
   VarList *params; // localsの部分集合になっていて引数だけが同じインスタンスとして入る
 
-  Node *node;
+  NodePool pool;
+  NodeId body;     // ND_BLOCK
   VarList *locals; // ローカル変数と引数の変数を含む
   int stack_size;
+
+  uint64_t cache_key; // Set if the output cache is enabled
+  char *cached_asm;   // Assembly taken from the cache, if any
+
+  Remark *remarks;     // Used by --remarks
+  CodeMetrics metrics; // Used by --remarks
 };
 
+extern _Thread_local NodePool *pool; // Pool of the function being parsed or generated
+
+int ident_len(char *p);
+NodeId copy_node(NodeId id);
+NodeId push_extra(NodeId *ids, int n);
+Function *function();
+Function *cached_function();
 Function *program();
+void free_function(Function *fn);
+
+//
+// remarks.c
+//
+
+// --remarks output format
+typedef enum {
+  REMARKS_NONE,
+  REMARKS_TEXT,
+  REMARKS_JSON,
+} RemarksFormat;
+
+extern RemarksFormat opt_remarks;
+
+void add_remark(Function *fn, uint32_t loc, char *fmt, ...);
+void count_code(Function *fn, char *text, int len);
+void print_remarks(Function *fn);
+
+//
+// optimize.c
+//
+
+extern bool opt_cse;
+extern bool opt_if_convert;
+
+void optimize(Function *fn);
+
+//
+// parallel.c
+//
+
+char *function_end(char *p);
+Function *parallel_program(int jobs);
 
 //
 // codegen.c
 //
 
+extern bool opt_instrument;
+extern bool opt_profile_generate;
+
+void println(char *fmt, ...);
+void gen(NodeId id);
+void read_profile(char *path);
+uint64_t hash_profile(uint64_t h, char *name);
+void codegen_header();
+void codegen_function(Function *fn);
 void codegen(Function *prog);
+
+//
+// isel.c
+//
+
+bool gen_pattern(NodeId id);
+
+//
+// cache.c
+//
+
+extern char *cache_dir;
+
+uint64_t fnv1a(uint64_t h, void *p, int len);
+void cache_init(char *dir);
+uint64_t function_key(Token *start, Token *end, char *name);
+char *cache_lookup(uint64_t key);
+void cache_store(uint64_t key, char *data, int len);
@@ -1,242 +1,841 @@
 #include "chibicc.h"
 
-char *argreg[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+char *argreg4[] = {"edi", "esi", "edx", "ecx", "r8d", "r9d"};
+char *argreg8[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
 
-int labelseq = 0;
+// Label numbers restart in every function and labels carry the function
+// name, so a function's assembly does not depend on what precedes it.
+int labelseq;
 char *funcname;
+Function *current_fn;
 
-void gen(Node *node);
+// -finstrument: count calls and accumulate cycles per function
+bool opt_instrument;
+
+// -fprofile-generate: count how often each branch condition is
+// evaluated and how often it is true
+bool opt_profile_generate;
+
+// Labels of the branches instrumented in the current function
+typedef struct EdgeList EdgeList;
+struct EdgeList {
+  EdgeList *next;
+  int seq;
+};
+
+EdgeList *edges;
+
+// Branch profile read by -fprofile-use. The branches of a function are
+// chained from its FuncProfile, and both are found through hash tables
+// keyed by function name and by (function, label number).
+typedef struct FuncProfile FuncProfile;
+typedef struct BranchProfile BranchProfile;
+
+struct FuncProfile {
+  char *name;
+  BranchProfile *branches;
+};
+
+struct BranchProfile {
+  BranchProfile *next; // Next branch of the same function
+  FuncProfile *fn;
+  int seq;    // Label number
+  long total; // Times the condition was evaluated
+  long taken; // Times the condition was true
+};
+
+// Open-addressing tables, kept at most half full. A NULL slot is free.
+typedef struct {
+  void **slots;
+  uint32_t mask;
+  int len;
+} ProfileTable;
+
+ProfileTable func_profiles;
+ProfileTable branch_profiles;
+
+// Output is written to stdout unless it is being captured into a buffer.
+typedef struct Buffer Buffer;
+struct Buffer {
+  Buffer *next;
+  char *data;
+  int len;
+  int capa;
+};
+
+Buffer *capture;
+
+// Cold blocks of the current function, emitted after its epilogue.
+Buffer *cold_blocks;
+
+void gen(NodeId id);
+
+// Writes raw text to stdout or to the buffer being captured.
+void emit(char *s, int len) {
+  if (!capture) {
+    fwrite(s, 1, len, stdout);
+    return;
+  }
+
+  if (capture->len + len + 1 > capture->capa) {
+    capture->capa = (capture->len + len + 1) * 2;
+    capture->data = realloc(capture->data, capture->capa);
+  }
+  memcpy(capture->data + capture->len, s, len);
+  capture->len += len;
+  capture->data[capture->len] = '\0';
+}
+
+void println(char *fmt, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+
+  char *p = buf;
+  if (len >= sizeof(buf)) {
+    p = malloc(len + 1);
+    va_start(ap, fmt);
+    vsnprintf(p, len + 1, fmt, ap);
+    va_end(ap);
+  }
+  emit(p, len);
+  emit("\n", 1);
+  if (p != buf)
+    free(p);
+}
+
+uint32_t hash_func_profile(char *name) {
+  return fnv1a(0xcbf29ce484222325, name, strlen(name)) >> 32;
+}
+
+uint32_t hash_branch_profile(FuncProfile *fn, int seq) {
+  uint64_t h = (uintptr_t)fn;
+  h = h * 0x9e3779b97f4a7c15 + seq;
+  return (h * 0x9e3779b97f4a7c15) >> 32;
+}
+
+// Returns the slot of `name` in func_profiles, which is NULL if the
+// function has no profile.
+FuncProfile **func_profile_slot(char *name) {
+  ProfileTable *t = &func_profiles;
+  if (!t->slots)
+    return NULL;
+  uint32_t i = hash_func_profile(name) & t->mask;
+  for (;; i = (i + 1) & t->mask) {
+    FuncProfile *fp = t->slots[i];
+    if (!fp || !strcmp(fp->name, name))
+      return (FuncProfile **)&t->slots[i];
+  }
+}
+
+BranchProfile **branch_profile_slot(FuncProfile *fn, int seq) {
+  ProfileTable *t = &branch_profiles;
+  if (!t->slots)
+    return NULL;
+  uint32_t i = hash_branch_profile(fn, seq) & t->mask;
+  for (;; i = (i + 1) & t->mask) {
+    BranchProfile *bp = t->slots[i];
+    if (!bp || (bp->fn == fn && bp->seq == seq))
+      return (BranchProfile **)&t->slots[i];
+  }
+}
+
+// Makes room for one more entry in `t`, rehashing the existing ones
+// as branches or as functions.
+void grow_profile_table(ProfileTable *t, bool branches) {
+  uint32_t old_capa = t->slots ? t->mask + 1 : 0;
+  if (old_capa && (t->len + 1) * 2 <= old_capa)
+    return;
+
+  void **old = t->slots;
+  uint32_t capa = old_capa ? old_capa * 2 : 64;
+  t->slots = calloc(capa, sizeof(void *));
+  t->mask = capa - 1;
+
+  for (uint32_t i = 0; i < old_capa; i++) {
+    if (!old[i])
+      continue;
+    if (branches) {
+      BranchProfile *bp = old[i];
+      *branch_profile_slot(bp->fn, bp->seq) = bp;
+    } else {
+      FuncProfile *fp = old[i];
+      *func_profile_slot(fp->name) = fp;
+    }
+  }
+  free(old);
+}
+
+void read_profile(char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    error("cannot open profile: %s", path);
+
+  char line[512];
+  char name[256];
+  int seq, arm;
+  long count;
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "edge %255s %d %d %ld", name, &seq, &arm, &count) != 4)
+      continue;
+
+    grow_profile_table(&func_profiles, false);
+    FuncProfile **fslot = func_profile_slot(name);
+    if (!*fslot) {
+      *fslot = calloc(1, sizeof(FuncProfile));
+      (*fslot)->name = strndup(name, strlen(name));
+      func_profiles.len++;
+    }
+    FuncProfile *fn = *fslot;
+
+    grow_profile_table(&branch_profiles, true);
+    BranchProfile **bslot = branch_profile_slot(fn, seq);
+    if (!*bslot) {
+      *bslot = calloc(1, sizeof(BranchProfile));
+      (*bslot)->fn = fn;
+      (*bslot)->seq = seq;
+      (*bslot)->next = fn->branches;
+      fn->branches = *bslot;
+      branch_profiles.len++;
+    }
+    BranchProfile *bp = *bslot;
+
+    if (arm == 0)
+      bp->total += count;
+    else
+      bp->taken += count;
+  }
+  fclose(fp);
+}
+
+FuncProfile *find_func_profile(char *name) {
+  FuncProfile **slot = func_profile_slot(name);
+  return slot ? *slot : NULL;
+}
+
+BranchProfile *find_branch_profile(int seq) {
+  FuncProfile *fn = find_func_profile(funcname);
+  if (!fn)
+    return NULL;
+  BranchProfile *bp = *branch_profile_slot(fn, seq);
+  return bp && bp->total ? bp : NULL;
+}
+
+// Bumps a -fprofile-generate counter. Arm 0 counts evaluations of the
+// branch condition and arm 1 counts the times it was true.
+void count_edge(int seq, int arm) {
+  if (!opt_profile_generate)
+    return;
+
+  if (arm == 0) {
+    EdgeList *el = calloc(1, sizeof(EdgeList));
+    el->seq = seq;
+    el->next = edges;
+    edges = el;
+  }
+  println("  inc qword ptr [rip+.Lprof.%s.%d.%d+16]", funcname, seq, arm);
+}
+
+// Generates `node` as an out-of-line block labeled .L<kind>.<fn>.<seq>
+// that jumps back to .Lend.<fn>.<seq> when done.
+void gen_cold(char *kind, int seq, int arm, NodeId node) {
+  Buffer *saved = capture;
+  capture = calloc(1, sizeof(Buffer));
+
+  println(".L%s.%s.%d:", kind, funcname, seq);
+  if (arm >= 0)
+    count_edge(seq, arm);
+  gen(node);
+  println("  jmp .Lend.%s.%d", funcname, seq);
+
+  // Blocks nested in this one are already on the list and end with
+  // their own jumps, so the order of the list does not matter.
+  capture->next = cold_blocks;
+  cold_blocks = capture;
+  capture = saved;
+}
 
 // Pushes the given node's address to the stack.
-void gen_addr(Node *node) {
+void gen_addr(NodeId id) {
+  Node *node = &pool->nodes[id];
   switch (node->kind) {
   case ND_VAR:
-    printf("  lea rax, [rbp-%d]\n", node->var->offset);
-    printf("  push rax\n");
+    println("  lea rax, [rbp-%d]", node->var->offset);
+    println("  push rax");
     return;
   case ND_DEREF:
     gen(node->lhs);
     return;
   }
 
-  error_tok(node->tok, "not an lvalue");
+  error_at(user_input + node->loc, "not an lvalue");
 }
 
-void load() {
-  printf("  pop rax\n");
-  printf("  mov rax, [rax]\n");
-  printf("  push rax\n");
+// Values are pushed as 8 bytes, but only the low 4 bytes of an int
+// are meaningful. Ints are sign-extended where they meet 64-bit
+// pointer arithmetic.
+void load(TypeId ty) {
+  println("  pop rax");
+  if (size_of(ty) == 4)
+    println("  mov eax, [rax]");
+  else
+    println("  mov rax, [rax]");
+  println("  push rax");
+}
+
+void store(TypeId ty) {
+  println("  pop rdi");
+  println("  pop rax");
+  if (size_of(ty) == 4)
+    println("  mov [rax], edi");
+  else
+    println("  mov [rax], rdi");
+  println("  push rdi");
+}
+
+// Pops a branch condition and compares it with zero.
+void cmp_zero(NodeId cond) {
+  println("  pop rax");
+  println("  cmp %s, 0", is_pointer(pool->nodes[cond].ty) ? "rax" : "eax");
+}
+
+// Arguments that can be loaded straight into their register or pushed
+// without being evaluated on the stack first.
+bool is_simple_arg(NodeId id) {
+  Node *node = &pool->nodes[id];
+  if (node->kind == ND_NUM || node->kind == ND_VAR)
+    return true;
+  return node->kind == ND_ADDR && pool->nodes[node->lhs].kind == ND_VAR;
+}
+
+// Loads a simple argument into the i-th argument register.
+void load_arg(NodeId id, int i) {
+  Node *node = &pool->nodes[id];
+  char *reg = is_pointer(node->ty) ? argreg8[i] : argreg4[i];
+  switch (node->kind) {
+  case ND_NUM:
+    println("  mov %s, %d", reg, node->val);
+    return;
+  case ND_VAR:
+    println("  mov %s, [rbp-%d]", reg, node->var->offset);
+    return;
+  case ND_ADDR:
+    println("  lea %s, [rbp-%d]", reg, pool->nodes[node->lhs].var->offset);
+    return;
+  }
+}
+
+// Pushes a simple argument that is passed on the stack. Ints take an
+// 8-byte slot whose upper half the callee ignores.
+void push_arg(NodeId id) {
+  Node *node = &pool->nodes[id];
+  switch (node->kind) {
+  case ND_NUM:
+    println("  push %d", node->val);
+    return;
+  case ND_VAR:
+    println("  push qword ptr [rbp-%d]", node->var->offset);
+    return;
+  case ND_ADDR:
+    println("  lea r11, [rbp-%d]", pool->nodes[node->lhs].var->offset);
+    println("  push r11");
+    return;
+  }
 }
 
-void store() {
-  printf("  pop rdi\n");
-  printf("  pop rax\n");
-  printf("  mov [rax], rdi\n");
-  printf("  push rdi\n");
+// Function call (System V ABI).
+//
+// Arguments that need computing are evaluated left to right onto the
+// stack. Then RSP is aligned to 16 bytes, with the old RSP saved on the
+// new stack. Arguments beyond the sixth are pushed right to left, and
+// the first six are loaded into their registers: computed ones from
+// where they were evaluated, simple ones directly from their variable
+// or immediate. No argument register is read while another is being
+// set, so the moves need no ordering.
+void gen_funcall(NodeId id) {
+  Node *node = &pool->nodes[id];
+  char *name = user_input + node->loc;
+  int len = ident_len(name);
+  int nargs = node->rhs;
+  NodeId *args = &pool->extra[node->lhs];
+  int nstack = nargs > 6 ? nargs - 6 : 0;
+
+  int ncomputed = 0;
+  for (int i = 0; i < nargs; i++) {
+    if (!is_simple_arg(args[i])) {
+      gen(args[i]);
+      ncomputed++;
+    }
+  }
+
+  // Offsets of the computed arguments from the old RSP
+  int *slot = calloc(nargs, sizeof(int));
+  for (int i = nargs - 1, off = 0; i >= 0; i--) {
+    if (!is_simple_arg(args[i])) {
+      slot[i] = off;
+      off += 8;
+    }
+  }
+
+  // スタックポインタを調整する
+  // 関数呼び出し時にRSPは16の倍数になってないといけないので、切り下げた上で
+  // 元のRSPと引数の個数を合わせて16の倍数になるようにする
+  println("  mov rax, rsp");
+  println("  and rsp, -16");
+  if (nstack % 2 == 0)
+    println("  sub rsp, 8");
+  println("  push rax");
+
+  for (int i = nargs - 1; i >= 6; i--) {
+    if (is_simple_arg(args[i]))
+      push_arg(args[i]);
+    else
+      println("  push qword ptr [rax+%d]", slot[i]);
+  }
+  for (int i = 0; i < nargs && i < 6; i++) {
+    if (is_simple_arg(args[i]))
+      load_arg(args[i], i);
+    else
+      println("  mov %s, [rax+%d]", argreg8[i], slot[i]);
+  }
+  free(slot);
+
+  // RAX is set to 0 for variadic function.
+  println("  mov rax, 0");
+  println("  call %.*s", len, name);
+  if (nstack)
+    println("  add rsp, %d", nstack * 8);
+  println("  pop rsp");
+  if (ncomputed)
+    println("  add rsp, %d", ncomputed * 8);
+  println("  push rax"); // 関数の返り値をスタックに積む
 }
 
 // Generate code for a given node.
-void gen(Node *node) {
+void gen(NodeId id) {
+  if (gen_pattern(id))
+    return;
+
+  Node *node = &pool->nodes[id];
   switch (node->kind) {
   case ND_NULL:
     // TODO: ND_EXPR_STMTでadd rsp, 8が実行されてしまうので適当に入れとく
-    printf("  push 0\n");
+    println("  push 0");
     return;
   case ND_NUM:
-    printf("  push %d\n", node->val);
+    println("  push %d", node->val);
     return;
   case ND_EXPR_STMT:
     gen(node->lhs);
-    printf("  add rsp, 8\n"); // 式の評価結果としてスタックに一つの値が残っているのでポップしておく (rspを加算する)
+    // 式の評価結果としてスタックに一つの値が残っているのでポップしておく
+    // returnのない関数が最後の式の値を返すようにRAXに取り出す
+    println("  pop rax");
     return;
   case ND_VAR: // 右辺に変数が現れた時にメモリからレジスタにコピーして1つの値にしてスタックにpush
-    gen_addr(node);
-    load();
+    gen_addr(id);
+    load(node->ty);
     return;
   case ND_ASSIGN:
     gen_addr(node->lhs);
     gen(node->rhs);
-    store();
+    store(node->ty);
     return;
   case ND_ADDR:
     gen_addr(node->lhs);
     return;
   case ND_DEREF:
     gen(node->lhs);
-    load();
+    load(node->ty);
     return;
   case ND_IF: {
+    NodeId then = pool->extra[node->rhs];
+    NodeId els = pool->extra[node->rhs + 1];
     int seq = labelseq++;
-    if (node->els) {
-      gen(node->cond);
-      printf("  pop rax\n");
-      printf("  cmp rax, 0\n");
-      printf("  je  .Lelse%d\n", seq);
-      gen(node->then);
-      printf("  jmp .Lend%d\n", seq);
-      printf(".Lelse%d:\n", seq);
-      gen(node->els);
-      printf(".Lend%d:\n", seq);
+    BranchProfile *bp = find_branch_profile(seq);
+    count_edge(seq, 0);
+    gen(node->lhs);
+    cmp_zero(node->lhs);
+
+    // With a profile, the hot arm falls through and the cold arm is
+    // moved past the epilogue.
+    if (bp && bp->taken < bp->total - bp->taken) {
+      add_remark(current_fn, node->loc,
+                 "then-arm moved out of line (taken %ld of %ld)", bp->taken,
+                 bp->total);
+      println("  jne .Lthen.%s.%d", funcname, seq);
+      // The then-arm goes to its own buffer, but it is generated first
+      // so that the branches in it get the same numbers as in the
+      // profiling build, which numbers them in source order.
+      gen_cold("then", seq, 1, then);
+      if (els)
+        gen(els);
+      println(".Lend.%s.%d:", funcname, seq);
+      return;
+    }
+    if (bp && els && bp->total - bp->taken < bp->taken) {
+      add_remark(current_fn, node->loc,
+                 "else-arm moved out of line (taken %ld of %ld)",
+                 bp->total - bp->taken, bp->total);
+      println("  je  .Lelse.%s.%d", funcname, seq);
+      count_edge(seq, 1);
+      gen(then);
+      println(".Lend.%s.%d:", funcname, seq);
+      gen_cold("else", seq, -1, els);
+      return;
+    }
+
+    if (els) {
+      println("  je  .Lelse.%s.%d", funcname, seq);
+      count_edge(seq, 1);
+      gen(then);
+      println("  jmp .Lend.%s.%d", funcname, seq);
+      println(".Lelse.%s.%d:", funcname, seq);
+      gen(els);
+      println(".Lend.%s.%d:", funcname, seq);
     } else {
-      gen(node->cond);
-      printf("  pop rax\n");
-      printf("  cmp rax, 0\n");
-      printf("  je  .Lend%d\n", seq);
-      gen(node->then);
-      printf(".Lend%d:\n", seq);
+      println("  je  .Lend.%s.%d", funcname, seq);
+      count_edge(seq, 1);
+      gen(then);
+      println(".Lend.%s.%d:", funcname, seq);
     }
     return;
   }
-  case ND_WHILE: {
-    int seq = labelseq++;
-    printf(".Lbegin%d:\n", seq);
-    gen(node->cond);
-    printf("  pop rax\n");
-    printf("  cmp rax, 0\n");
-    printf("  je  .Lend%d\n", seq);
-    gen(node->then);
-    printf("  jmp .Lbegin%d\n", seq);
-    printf(".Lend%d:\n", seq);
+  case ND_SELECT: {
+    NodeId then = pool->extra[node->rhs];
+    NodeId els = pool->extra[node->rhs + 1];
+    Node *a = &pool->nodes[then];
+    Node *b = &pool->nodes[els];
+    gen(node->lhs);
+
+    // c ? 1 : 0 and c ? 0 : 1 are just the truth value of c.
+    if (a->kind == ND_NUM && b->kind == ND_NUM && a->val + b->val == 1 &&
+        (a->val == 0 || a->val == 1)) {
+      cmp_zero(node->lhs);
+      println("  set%s al", a->val ? "ne" : "e");
+      println("  movzb eax, al");
+      println("  push rax");
+      return;
+    }
+
+    gen(then);
+    gen(els);
+    println("  pop rdi");
+    println("  pop rax");
+    println("  pop rdx");
+    println("  cmp %s, 0", is_pointer(pool->nodes[node->lhs].ty) ? "rdx" : "edx");
+    println("  cmove rax, rdi");
+    println("  push rax");
     return;
   }
+  case ND_WHILE:
   case ND_FOR: {
+    NodeId init = 0, cond = node->lhs, inc = 0, then = node->rhs;
+    if (node->kind == ND_FOR) {
+      NodeId *parts = &pool->extra[node->rhs];
+      init = parts[0];
+      cond = parts[1];
+      inc = parts[2];
+      then = parts[3];
+    }
+
     int seq = labelseq++;
-    if (node->init)
-      gen(node->init);
-    printf(".Lbegin%d:\n", seq);
-    if (node->cond) {
-      gen(node->cond);
-      printf("  pop rax\n");
-      printf("  cmp rax, 0\n");
-      printf("  je  .Lend%d\n", seq);
+    BranchProfile *bp = find_branch_profile(seq);
+    if (init)
+      gen(init);
+
+    // A loop whose body runs more often than the loop is left is
+    // rotated so that each iteration takes a single backward branch.
+    if (bp && cond && bp->taken > bp->total - bp->taken) {
+      add_remark(current_fn, node->loc,
+                 "loop rotated (%ld iterations in %ld entries)", bp->taken,
+                 bp->total - bp->taken);
+      println("  jmp .Lcond.%s.%d", funcname, seq);
+      println(".Lbegin.%s.%d:", funcname, seq);
+      count_edge(seq, 1);
+      gen(then);
+      if (inc)
+        gen(inc);
+      println(".Lcond.%s.%d:", funcname, seq);
+      count_edge(seq, 0);
+      gen(cond);
+      cmp_zero(cond);
+      println("  jne .Lbegin.%s.%d", funcname, seq);
+      println(".Lend.%s.%d:", funcname, seq);
+      return;
     }
-    gen(node->then);
-    if (node->inc)
-      gen(node->inc);
-    printf("  jmp .Lbegin%d\n", seq);
-    printf(".Lend%d:\n", seq);
+
+    println(".Lbegin.%s.%d:", funcname, seq);
+    if (cond) {
+      count_edge(seq, 0);
+      gen(cond);
+      cmp_zero(cond);
+      println("  je  .Lend.%s.%d", funcname, seq);
+      count_edge(seq, 1);
+    }
+    gen(then);
+    if (inc)
+      gen(inc);
+    println("  jmp .Lbegin.%s.%d", funcname, seq);
+    println(".Lend.%s.%d:", funcname, seq);
     return;
   }
   case ND_BLOCK:
-    for (Node *n = node->body; n; n = n->next)
-      gen(n);
-    return;
-  case ND_FUNCALL: {
-    int nargs = 0;
-    for (Node *arg = node->args; arg; arg = arg->next) {
-      gen(arg);
-      nargs++;
-    }
-    for (int i = nargs - 1; i >= 0; i--)
-      printf("  pop %s\n", argreg[i]);
-    
-    // スタックポインタを調整する
-    // pushとpopは8バイトRSPを増減させるが、関数呼び出し時にRSPは16の倍数になってないといけない
-    // このため16の倍数であるかを確認し、そうでない場合は8の倍数と仮定しRSPを8バイト分押し下げてからcallする
-    // We need to align RSP to a 16 byte boundary before
-    // calling a function because it is an ABI requirement.
-    // RAX is set to 0 for variadic function.
-    int seq = labelseq++;
-    printf("  mov rax, rsp\n");
-    printf("  and rax, 15\n"); // 0x1111 とANDを取り下位4ビットを取り出す
-    printf("  jnz .Lcall%d\n", seq); // rspの下位4ビットがゼロではなかったら、スタックポインタの調整をするためジャンプ
-    printf("  mov rax, 0\n");
-    printf("  call %s\n", node->funcname);
-    printf("  jmp .Lend%d\n", seq);
-    printf(".Lcall%d:\n", seq);
-    printf("  sub rsp, 8\n"); // 8バイト押し下げておく
-    printf("  mov rax, 0\n");
-    printf("  call %s\n", node->funcname);
-    printf("  add rsp, 8\n"); // 戻す
-    printf(".Lend%d:\n", seq);
-    printf("  push rax\n"); // 関数の返り値をスタックに積む
+    for (int i = 0; i < node->rhs; i++)
+      gen(pool->extra[node->lhs + i]);
+    return;
+  case ND_FUNCALL:
+    gen_funcall(id);
     return;
-  }
   case ND_RETURN:
     gen(node->lhs);
-    printf("  pop rax\n");
-    printf("  jmp .Lreturn.%s\n", funcname);
+    println("  pop rax");
+    println("  jmp .Lreturn.%s", funcname);
     return;
   }
 
   gen(node->lhs);
   gen(node->rhs);
 
-  printf("  pop rdi\n");
-  printf("  pop rax\n");
+  println("  pop rdi");
+  println("  pop rax");
+
+  // int同士の演算は32ビットレジスタで行う。ポインタが絡む場合は64ビットで
+  // 行い、int側のオペランドを符号拡張しておく
+  TypeId lty = pool->nodes[node->lhs].ty;
+  TypeId rty = pool->nodes[node->rhs].ty;
+  char *ax = "eax", *di = "edi";
+  if (is_pointer(lty) || is_pointer(rty)) {
+    ax = "rax";
+    di = "rdi";
+    if (!is_pointer(lty))
+      println("  movsxd rax, eax");
+    if (!is_pointer(rty))
+      println("  movsxd rdi, edi");
+  }
 
   switch (node->kind) {
   case ND_ADD:
-    printf("  add rax, rdi\n");
+    println("  add %s, %s", ax, di);
     break;
   case ND_SUB:
-    printf("  sub rax, rdi\n");
+    println("  sub %s, %s", ax, di);
     break;
   case ND_MUL:
-    printf("  imul rax, rdi\n");
+    println("  imul %s, %s", ax, di);
     break;
   case ND_DIV:
-    // RAXに入っている64ビット値を128ビットに伸ばしてRDXとRAXセット
-    printf("  cqo\n");
-    // RDX+RAXの128ビット整数をRDIで割り、商をRAXに, 余りをRDXにセット
-    printf("  idiv rdi\n");
+    // EAXに入っている32ビット値を64ビットに伸ばしてEDXとEAXセット
+    println("  cdq");
+    // EDX+EAXの64ビット整数をEDIで割り、商をEAXに, 余りをEDXにセット
+    println("  idiv edi");
     break;
   case ND_EQ: // ==
     // cmpはフラグレジスタという特殊なレジスタに結果がセットされる
-    printf("  cmp rax, rdi\n");
+    println("  cmp %s, %s", ax, di);
     // フラグレジスタの結果をal (raxの下位8ビット)にコピーする。seteは同じ場合は1が入る (equal)
-    printf("  sete al\n");
+    println("  sete al");
     // 下位8ビットより左の64ビットの余っている部分をゼロクリアする
-    printf("  movzb rax, al\n");
+    println("  movzb rax, al");
     break;
   case ND_NE: // !=
-    printf("  cmp rax, rdi\n");
-    printf("  setne al\n"); // 違う場合に1がセットされる (not equal)
-    printf("  movzb rax, al\n");
+    println("  cmp %s, %s", ax, di);
+    println("  setne al"); // 違う場合に1がセットされる (not equal)
+    println("  movzb rax, al");
     break;
   case ND_LT: // <
-    printf("  cmp rax, rdi\n");
-    printf("  setl al\n"); // 小さい場合に1がセットされる (set lighter)
-    printf("  movzb rax, al\n");
+    println("  cmp %s, %s", ax, di);
+    println("  setl al"); // 小さい場合に1がセットされる (set lighter)
+    println("  movzb rax, al");
     break;
   case ND_LE: // <=
-    printf("  cmp rax, rdi\n");
-    printf("  setle al\n"); // 小さい場合に1がセットされる (set lighter or equal)
-    printf("  movzb rax, al\n");
+    println("  cmp %s, %s", ax, di);
+    println("  setle al"); // 小さい場合に1がセットされる (set lighter or equal)
+    println("  movzb rax, al");
     break;
   }
 
-  printf("  push rax\n");
+  println("  push rax");
 }
 
-void codegen(Function *prog) {
-  printf(".intel_syntax noprefix\n");
-
-  for (Function *fn = prog; fn; fn = fn->next) {
-    printf(".global %s\n", fn->name);
-    printf("%s:\n", fn->name);
-    funcname = fn->name;
-
-    // Prologue
-    printf("  push rbp\n");
-    printf("  mov rbp, rsp\n");
-    printf("  sub rsp, %d\n", fn->stack_size);
-
-    // Push arguments to the stack
-    int i = 0;
-    for (VarList *vl = fn->params; vl; vl = vl->next) {
-      Var *var = vl->var;
-      printf("  mov [rbp-%d], %s\n", var->offset, argreg[i++]);
+// Reads the time stamp counter into RAX. Clobbers RDX.
+void read_tsc() {
+  println("  rdtsc");
+  println("  shl rdx, 32");
+  println("  or rax, rdx");
+}
+
+// Emits a profiling record. Records live in their own section so that
+// the linker gathers the records of all objects into one table, which
+// runtime/profile.c walks and dumps at exit. The layout must match
+// ProfRecord there.
+void emit_prof_record(char *label, int seq, int arm) {
+  println("  .align 8");
+  println("%s:", label);
+  println("  .quad .Lname.%s", funcname);
+  println("  .long %d, %d", seq, arm);
+  println("  .quad 0"); // count
+  println("  .quad 0"); // cycles
+}
+
+void emit_prof_records(Function *fn) {
+  char label[300];
+
+  println("  .section __chibicc_prof,\"aw\",@progbits");
+  if (opt_instrument) {
+    snprintf(label, sizeof(label), ".Lprof.%s", fn->name);
+    emit_prof_record(label, -1, 0);
+  }
+  for (EdgeList *el = edges; el; el = el->next) {
+    for (int arm = 0; arm < 2; arm++) {
+      snprintf(label, sizeof(label), ".Lprof.%s.%d.%d", fn->name, el->seq, arm);
+      emit_prof_record(label, el->seq, arm);
     }
+  }
 
-    // Emit code
-    for (Node *node = fn->node; node; node = node->next)
-      gen(node);
+  println("  .section .rodata");
+  println(".Lname.%s:", fn->name);
+  println("  .string \"%s\"", fn->name);
+  println("  .text");
+}
 
-    // Epilogue
-    printf(".Lreturn.%s:\n", funcname);
-    printf("  mov rsp, rbp\n");
-    printf("  pop rbp\n");
-    printf("  ret\n");
+// Mixes the -fprofile-use data for a function into a cache key.
+uint64_t hash_profile(uint64_t h, char *name) {
+  FuncProfile *fn = find_func_profile(name);
+  if (!fn)
+    return h;
+  for (BranchProfile *bp = fn->branches; bp; bp = bp->next) {
+    h = fnv1a(h, &bp->seq, sizeof(bp->seq));
+    h = fnv1a(h, &bp->total, sizeof(bp->total));
+    h = fnv1a(h, &bp->taken, sizeof(bp->taken));
   }
+  return h;
+}
+
+void gen_function(Function *fn) {
+  println(".global %s", fn->name);
+  println("%s:", fn->name);
+  funcname = fn->name;
+  current_fn = fn;
+  labelseq = 0;
+  edges = NULL;
+  cold_blocks = NULL;
+
+  // The entry timestamp is kept in an extra slot below the locals
+  // so that recursive calls get their own.
+  int stack_size = fn->stack_size;
+  int tsc_offset = 0;
+  if (opt_instrument) {
+    stack_size += 8;
+    tsc_offset = stack_size;
+  }
+
+  // Prologue
+  println("  push rbp");
+  println("  mov rbp, rsp");
+  println("  sub rsp, %d", stack_size);
+
+  // Push arguments to the stack
+  int i = 0;
+  for (VarList *vl = fn->params; vl; vl = vl->next, i++) {
+    Var *var = vl->var;
+    char *reg;
+    if (i < 6) {
+      reg = (size_of(var->ty) == 4) ? argreg4[i] : argreg8[i];
+    } else {
+      // The rest are on the stack above the return address.
+      reg = (size_of(var->ty) == 4) ? "eax" : "rax";
+      println("  mov %s, [rbp+%d]", reg, 16 + (i - 6) * 8);
+    }
+    println("  mov [rbp-%d], %s", var->offset, reg);
+  }
+
+  // rdtsc clobbers RDX, so this must come after the arguments are saved.
+  // The counters are bumped with plain (non-atomic) adds to keep the
+  // overhead down; counts may be slightly off in threaded programs.
+  if (opt_instrument) {
+    println("  inc qword ptr [rip+.Lprof.%s+16]", funcname);
+    read_tsc();
+    println("  mov [rbp-%d], rax", tsc_offset);
+  }
+
+  // Emit code
+  pool = &fn->pool;
+  gen(fn->body);
+
+  // Epilogue
+  println(".Lreturn.%s:", funcname);
+  if (opt_instrument) {
+    // Preserve the return value across rdtsc.
+    println("  mov rdi, rax");
+    read_tsc();
+    println("  sub rax, [rbp-%d]", tsc_offset);
+    println("  add [rip+.Lprof.%s+24], rax", funcname);
+    println("  mov rax, rdi");
+  }
+  println("  mov rsp, rbp");
+  println("  pop rbp");
+  println("  ret");
+
+  while (cold_blocks) {
+    Buffer *buf = cold_blocks;
+    cold_blocks = buf->next;
+    emit(buf->data, buf->len);
+    free(buf->data);
+    free(buf);
+  }
+
+  if (opt_instrument || edges)
+    emit_prof_records(fn);
+
+  while (edges) {
+    EdgeList *el = edges;
+    edges = el->next;
+    free(el);
+  }
+}
+
+void codegen_header() {
+  println(".intel_syntax noprefix");
+}
+
+void codegen_function(Function *fn) {
+  if (fn->cached_asm) {
+    int len = strlen(fn->cached_asm);
+    emit(fn->cached_asm, len);
+    if (opt_remarks) {
+      count_code(fn, fn->cached_asm, len);
+      print_remarks(fn);
+    }
+    return;
+  }
+
+  if (!cache_dir && !opt_remarks) {
+    gen_function(fn);
+    return;
+  }
+
+  // Capture the function's assembly so that it can be cached or
+  // inspected.
+  capture = calloc(1, sizeof(Buffer));
+  gen_function(fn);
+  Buffer *buf = capture;
+  capture = NULL;
+
+  if (cache_dir)
+    cache_store(fn->cache_key, buf->data, buf->len);
+  emit(buf->data, buf->len);
+  if (opt_remarks) {
+    count_code(fn, buf->data, buf->len);
+    print_remarks(fn);
+  }
+  free(buf->data);
+  free(buf);
+}
+
+void codegen(Function *prog) {
+  codegen_header();
+  for (Function *fn = prog; fn; fn = fn->next)
+    codegen_function(fn);
 }
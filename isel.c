@@ -0,0 +1,387 @@
+#include "chibicc.h"
+
+// Instruction selection by maximal munch.
+//
+// Before falling back to its generic stack-machine sequence, gen()
+// offers each node to the patterns below. A pattern's match function
+// returns how many nodes of the tree rooted at the node it covers, or 0
+// if it does not apply. Its emit function generates code for the whole
+// tile and leaves the result on the stack like gen() does, generating
+// the uncovered subtrees with gen(). The largest tile wins and the cost
+// (estimated instructions) breaks ties, so adding a pattern only takes
+// an entry in the table.
+
+typedef struct Pattern Pattern;
+struct Pattern {
+  char *name;
+  int cost;
+  int (*match)(NodeId id);
+  void (*emit)(NodeId id);
+};
+
+Node *get_node(NodeId id) {
+  return &pool->nodes[id];
+}
+
+bool is_num(NodeId id) {
+  return get_node(id)->kind == ND_NUM;
+}
+
+// An operator on ints that yields an int
+bool is_int_op(NodeId id) {
+  Node *node = get_node(id);
+  return node->ty == TY_INT && get_node(node->lhs)->ty == TY_INT &&
+         get_node(node->rhs)->ty == TY_INT;
+}
+
+bool is_arith(NodeKind kind) {
+  return kind == ND_ADD || kind == ND_SUB || kind == ND_MUL;
+}
+
+bool is_compare(NodeKind kind) {
+  return kind == ND_EQ || kind == ND_NE || kind == ND_LT || kind == ND_LE;
+}
+
+// If `id` computes an address at a constant offset from RBP, i.e.
+// &var optionally plus or minus constants, sets *off to the offset and
+// returns the number of nodes involved.
+int frame_addr(NodeId id, int *off) {
+  Node *node = get_node(id);
+  if (node->kind == ND_ADDR && get_node(node->lhs)->kind == ND_VAR) {
+    *off = -get_node(node->lhs)->var->offset;
+    return 2;
+  }
+
+  if ((node->kind != ND_ADD && node->kind != ND_SUB) || !is_pointer(node->ty))
+    return 0;
+  Node *rhs = get_node(node->rhs);
+  if (rhs->kind != ND_MUL || !is_num(rhs->lhs) || !is_num(rhs->rhs))
+    return 0;
+  int n = frame_addr(node->lhs, off);
+  if (!n)
+    return 0;
+
+  long d = (long)get_node(rhs->lhs)->val * get_node(rhs->rhs)->val;
+  long o = (node->kind == ND_ADD) ? *off + d : *off - d;
+  if (o < INT32_MIN || o > INT32_MAX)
+    return 0;
+  *off = o;
+  return n + 4;
+}
+
+// Like frame_addr(), but for an lvalue: a variable or a dereferenced
+// frame address.
+int frame_lvalue(NodeId id, int *off) {
+  Node *node = get_node(id);
+  if (node->kind == ND_VAR) {
+    *off = -node->var->offset;
+    return 1;
+  }
+  if (node->kind == ND_DEREF) {
+    int n = frame_addr(node->lhs, off);
+    return n ? n + 1 : 0;
+  }
+  return 0;
+}
+
+char *arith_insn(NodeKind kind) {
+  switch (kind) {
+  case ND_ADD:
+    return "add";
+  case ND_SUB:
+    return "sub";
+  }
+  return "imul";
+}
+
+// Condition code of a comparison, or of its mirror image if the
+// operands are swapped.
+char *cond_code(NodeKind kind, bool swapped) {
+  switch (kind) {
+  case ND_EQ:
+    return "e";
+  case ND_NE:
+    return "ne";
+  case ND_LT:
+    return swapped ? "g" : "l";
+  }
+  return swapped ? "ge" : "le";
+}
+
+void emit_setcc(char *cc) {
+  println("  set%s al", cc);
+  println("  movzb eax, al");
+  println("  push rax");
+}
+
+// push [rbp+imm]
+int match_push_frame(NodeId id) {
+  int off;
+  return frame_lvalue(id, &off);
+}
+
+void emit_push_frame(NodeId id) {
+  int off;
+  frame_lvalue(id, &off);
+  println("  push qword ptr [rbp%+d]", off);
+}
+
+// lea rax, [rbp+imm]
+int match_lea_frame(NodeId id) {
+  int off;
+  return frame_addr(id, &off);
+}
+
+void emit_lea_frame(NodeId id) {
+  int off;
+  frame_addr(id, &off);
+  println("  lea rax, [rbp%+d]", off);
+  println("  push rax");
+}
+
+// add eax, [rbp+imm]
+int match_arith_frame(NodeId id) {
+  Node *node = get_node(id);
+  int off;
+  if (!is_arith(node->kind) || !is_int_op(id))
+    return 0;
+  int n = frame_lvalue(node->rhs, &off);
+  return n ? n + 1 : 0;
+}
+
+void emit_arith_frame(NodeId id) {
+  Node *node = get_node(id);
+  int off;
+  frame_lvalue(node->rhs, &off);
+  char *insn = arith_insn(node->kind);
+  gen(node->lhs);
+  println("  pop rax");
+  println("  %s eax, [rbp%+d]", insn, off);
+  println("  push rax");
+}
+
+// add eax, imm
+int match_arith_imm(NodeId id) {
+  Node *node = get_node(id);
+  if (!is_arith(node->kind) || !is_int_op(id) || !is_num(node->rhs))
+    return 0;
+  return 2;
+}
+
+void emit_arith_imm(NodeId id) {
+  Node *node = get_node(id);
+  NodeKind kind = node->kind;
+  int val = get_node(node->rhs)->val;
+  gen(node->lhs);
+  println("  pop rax");
+  if (kind == ND_MUL)
+    println("  imul eax, eax, %d", val);
+  else
+    println("  %s eax, %d", arith_insn(kind), val);
+  println("  push rax");
+}
+
+// idiv dword ptr [rbp+imm]
+int match_div_frame(NodeId id) {
+  Node *node = get_node(id);
+  int off;
+  if (node->kind != ND_DIV || !is_int_op(id))
+    return 0;
+  int n = frame_lvalue(node->rhs, &off);
+  return n ? n + 1 : 0;
+}
+
+void emit_div_frame(NodeId id) {
+  Node *node = get_node(id);
+  int off;
+  frame_lvalue(node->rhs, &off);
+  gen(node->lhs);
+  println("  pop rax");
+  println("  cdq");
+  println("  idiv dword ptr [rbp%+d]", off);
+  println("  push rax");
+}
+
+// cmp eax, imm
+int match_cmp_imm(NodeId id) {
+  Node *node = get_node(id);
+  if (!is_compare(node->kind) || !is_int_op(id) || !is_num(node->rhs))
+    return 0;
+  return 2;
+}
+
+void emit_cmp_imm(NodeId id) {
+  Node *node = get_node(id);
+  char *cc = cond_code(node->kind, false);
+  int val = get_node(node->rhs)->val;
+  gen(node->lhs);
+  println("  pop rax");
+  println("  cmp eax, %d", val);
+  emit_setcc(cc);
+}
+
+// cmp eax, imm with the constant on the left, as in "x > 3"
+int match_cmp_imm_swapped(NodeId id) {
+  Node *node = get_node(id);
+  if (!is_compare(node->kind) || !is_int_op(id) || !is_num(node->lhs))
+    return 0;
+  return 2;
+}
+
+void emit_cmp_imm_swapped(NodeId id) {
+  Node *node = get_node(id);
+  char *cc = cond_code(node->kind, true);
+  int val = get_node(node->lhs)->val;
+  gen(node->rhs);
+  println("  pop rax");
+  println("  cmp eax, %d", val);
+  emit_setcc(cc);
+}
+
+// cmp eax, [rbp+imm]
+int match_cmp_frame(NodeId id) {
+  Node *node = get_node(id);
+  int off;
+  if (!is_compare(node->kind) || !is_int_op(id))
+    return 0;
+  int n = frame_lvalue(node->rhs, &off);
+  return n ? n + 1 : 0;
+}
+
+void emit_cmp_frame(NodeId id) {
+  Node *node = get_node(id);
+  int off;
+  frame_lvalue(node->rhs, &off);
+  char *cc = cond_code(node->kind, false);
+  gen(node->lhs);
+  println("  pop rax");
+  println("  cmp eax, [rbp%+d]", off);
+  emit_setcc(cc);
+}
+
+// Pointer plus a scaled index that is not a constant
+int match_lea_index(NodeId id) {
+  Node *node = get_node(id);
+  if (node->kind != ND_ADD || !is_pointer(node->ty))
+    return 0;
+  Node *mul = get_node(node->rhs);
+  if (mul->kind != ND_MUL || is_num(mul->lhs) || !is_num(mul->rhs))
+    return 0;
+  int scale = get_node(mul->rhs)->val;
+  if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+    return 0;
+  return 3;
+}
+
+// lea rax, [rax+rdi*scale]
+void emit_lea_index(NodeId id) {
+  Node *node = get_node(id);
+  Node *mul = get_node(node->rhs);
+  NodeId index = mul->lhs;
+  int scale = get_node(mul->rhs)->val;
+  gen(node->lhs);
+  gen(index);
+  println("  pop rdi");
+  println("  pop rax");
+  println("  movsxd rdi, edi");
+  println("  lea rax, [rax+rdi*%d]", scale);
+  println("  push rax");
+}
+
+// Pointer plus or minus a constant number of elements
+int match_lea_imm(NodeId id) {
+  Node *node = get_node(id);
+  if ((node->kind != ND_ADD && node->kind != ND_SUB) || !is_pointer(node->ty))
+    return 0;
+  Node *mul = get_node(node->rhs);
+  if (mul->kind != ND_MUL || !is_num(mul->lhs) || !is_num(mul->rhs))
+    return 0;
+  return 4;
+}
+
+// lea rax, [rax+imm]
+void emit_lea_imm(NodeId id) {
+  Node *node = get_node(id);
+  Node *mul = get_node(node->rhs);
+  long d = (long)get_node(mul->lhs)->val * get_node(mul->rhs)->val;
+  if (node->kind == ND_SUB)
+    d = -d;
+  gen(node->lhs);
+  println("  pop rax");
+  println("  lea rax, [rax%+ld]", d);
+  println("  push rax");
+}
+
+// Assignment statement to a frame slot. Nothing is pushed because the
+// value of the statement is discarded.
+int match_store_frame(NodeId id) {
+  Node *node = get_node(id);
+  int off;
+  if (node->kind != ND_EXPR_STMT || get_node(node->lhs)->kind != ND_ASSIGN)
+    return 0;
+  int n = frame_lvalue(get_node(node->lhs)->lhs, &off);
+  return n ? n + 2 : 0;
+}
+
+// mov [rbp+imm], eax
+void emit_store_frame(NodeId id) {
+  Node *assign = get_node(get_node(id)->lhs);
+  int off;
+  frame_lvalue(assign->lhs, &off);
+  char *reg = (size_of(assign->ty) == 4) ? "eax" : "rax";
+  gen(assign->rhs);
+  println("  pop rax");
+  println("  mov [rbp%+d], %s", off, reg);
+}
+
+int match_store_frame_imm(NodeId id) {
+  int n = match_store_frame(id);
+  if (!n || !is_num(get_node(get_node(id)->lhs)->rhs))
+    return 0;
+  return n + 1;
+}
+
+// mov dword ptr [rbp+imm], imm
+void emit_store_frame_imm(NodeId id) {
+  Node *assign = get_node(get_node(id)->lhs);
+  int off;
+  frame_lvalue(assign->lhs, &off);
+  char *size = (size_of(assign->ty) == 4) ? "dword" : "qword";
+  println("  mov %s ptr [rbp%+d], %d", size, off, get_node(assign->rhs)->val);
+}
+
+Pattern patterns[] = {
+  {"push [rbp+imm]", 1, match_push_frame, emit_push_frame},
+  {"lea rax, [rbp+imm]", 2, match_lea_frame, emit_lea_frame},
+  {"add eax, [rbp+imm]", 3, match_arith_frame, emit_arith_frame},
+  {"add eax, imm", 3, match_arith_imm, emit_arith_imm},
+  {"idiv [rbp+imm]", 4, match_div_frame, emit_div_frame},
+  {"cmp eax, imm", 5, match_cmp_imm, emit_cmp_imm},
+  {"cmp imm, eax", 5, match_cmp_imm_swapped, emit_cmp_imm_swapped},
+  {"cmp eax, [rbp+imm]", 5, match_cmp_frame, emit_cmp_frame},
+  {"lea rax, [rax+rdi*s]", 5, match_lea_index, emit_lea_index},
+  {"lea rax, [rax+imm]", 3, match_lea_imm, emit_lea_imm},
+  {"mov [rbp+imm], eax", 2, match_store_frame, emit_store_frame},
+  {"mov [rbp+imm], imm", 1, match_store_frame_imm, emit_store_frame_imm},
+};
+
+// Generates `id` with the best matching pattern. Returns false if no
+// pattern matches.
+bool gen_pattern(NodeId id) {
+  Pattern *best = NULL;
+  int best_size = 0;
+  for (int i = 0; i < sizeof(patterns) / sizeof(*patterns); i++) {
+    Pattern *p = &patterns[i];
+    int size = p->match(id);
+    if (size > best_size ||
+        (size && size == best_size && p->cost < best->cost)) {
+      best = p;
+      best_size = size;
+    }
+  }
+
+  if (!best)
+    return false;
+  best->emit(id);
+  return true;
+}
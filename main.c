@@ -1,26 +1,289 @@
 #include "chibicc.h"
+#include <sys/resource.h>
+#include <time.h>
+
+_Thread_local Stats stats;
+
+// --stats output format
+typedef enum {
+  STATS_NONE,
+  STATS_TEXT,
+  STATS_JSON,
+} StatsFormat;
+
+StatsFormat opt_stats;
+
+// Per-phase measurements for --stats.
+typedef struct Phase Phase;
+struct Phase {
+  char *name;
+  double wall;   // Wall time in milliseconds
+  double cpu;    // CPU time in milliseconds
+  Stats delta;   // Counters accumulated during this phase
+  long peak_rss; // Peak RSS in KiB at the end of this phase
+};
+
+Phase phases[8];
+int nphases;
+
+double wall_start, cpu_start;
+Stats stats_start;
+
+// Only C11 clocks are used because we build with -std=c11.
+double now_wall() {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+double now_cpu() {
+  return clock() * 1e3 / CLOCKS_PER_SEC;
+}
+
+void phase_begin() {
+  if (!opt_stats)
+    return;
+  wall_start = now_wall();
+  cpu_start = now_cpu();
+  stats_start = stats;
+}
+
+void phase_end(char *name) {
+  if (!opt_stats)
+    return;
+
+  // Flush pending assembly so that its write cost is charged here.
+  fflush(stdout);
+
+  Phase *ph = &phases[nphases++];
+  ph->name = name;
+  ph->wall = now_wall() - wall_start;
+  ph->cpu = now_cpu() - cpu_start;
+  ph->delta.tokens = stats.tokens - stats_start.tokens;
+  ph->delta.nodes = stats.nodes - stats_start.nodes;
+  ph->delta.vars = stats.vars - stats_start.vars;
+  ph->delta.funcs = stats.funcs - stats_start.funcs;
+  ph->delta.bytes = stats.bytes - stats_start.bytes;
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  ph->peak_rss = ru.ru_maxrss;
+}
+
+// Round up `n` to the nearest multiple of `align`, which must be a
+// power of two.
+int align_to(int n, int align) {
+  return (n + align - 1) & ~(align - 1);
+}
+
+// Assign offsets to local variables. Each variable is aligned to its
+// size.
+void assign_lvar_offsets(Function *fn) {
+  int offset = 0;
+  for (VarList *vl = fn->locals; vl; vl = vl->next) {
+    int size = size_of(vl->var->ty);
+    offset = align_to(offset + size, size);
+    vl->var->offset = offset;
+  }
+  // Keep RSP a multiple of 8 so that the 8-byte slots of the expression
+  // stack, and the -finstrument timestamp below the locals, are aligned.
+  fn->stack_size = align_to(offset, 8);
+}
+
+// Compiles one function at a time: parse it, lay out its frame,
+// generate and flush its code, and free it before reading the next one.
+// Memory use is bounded by the largest function rather than the whole
+// program, and output starts after the first function. If a later
+// function has an error, the output so far is incomplete.
+void stream_program() {
+  codegen_header();
+
+  for (char *p = user_input; *p;) {
+    char *end = function_end(p);
+    tokenize_range(p, end);
+    if (at_eof())
+      break;
+
+    Function *fn = cache_dir ? cached_function() : function();
+    optimize(fn);
+    assign_lvar_offsets(fn);
+    codegen_function(fn);
+    fflush(stdout);
+    free_function(fn);
+    p = end;
+  }
+}
+
+// Stats go to stderr because stdout carries the assembly.
+void print_stats() {
+  Phase total = {"total"};
+  for (int i = 0; i < nphases; i++) {
+    Phase *ph = &phases[i];
+    total.wall += ph->wall;
+    total.cpu += ph->cpu;
+    total.delta.tokens += ph->delta.tokens;
+    total.delta.nodes += ph->delta.nodes;
+    total.delta.vars += ph->delta.vars;
+    total.delta.funcs += ph->delta.funcs;
+    total.delta.bytes += ph->delta.bytes;
+    total.peak_rss = ph->peak_rss;
+  }
+  phases[nphases] = total;
+
+  if (opt_stats == STATS_JSON) {
+    fprintf(stderr, "{\"phases\":[");
+    for (int i = 0; i <= nphases; i++) {
+      Phase *ph = &phases[i];
+      fprintf(stderr,
+              "%s{\"name\":\"%s\",\"wall_ms\":%.3f,\"cpu_ms\":%.3f,"
+              "\"tokens\":%ld,\"nodes\":%ld,\"vars\":%ld,\"funcs\":%ld,"
+              "\"bytes\":%ld,\"peak_rss_kb\":%ld}",
+              i ? "," : "", ph->name, ph->wall, ph->cpu, ph->delta.tokens,
+              ph->delta.nodes, ph->delta.vars, ph->delta.funcs,
+              ph->delta.bytes, ph->peak_rss);
+    }
+    fprintf(stderr, "]");
+    if (cache_dir)
+      fprintf(stderr, ",\"cache\":{\"hits\":%ld,\"misses\":%ld}",
+              stats.cache_hits, stats.cache_misses);
+    fprintf(stderr, "}\n");
+    return;
+  }
+
+  fprintf(stderr, "%-10s %10s %10s %8s %8s %8s %8s %12s %12s\n", "phase",
+          "wall(ms)", "cpu(ms)", "tokens", "nodes", "vars", "funcs", "bytes",
+          "peak_rss(KB)");
+  for (int i = 0; i <= nphases; i++) {
+    Phase *ph = &phases[i];
+    fprintf(stderr, "%-10s %10.3f %10.3f %8ld %8ld %8ld %8ld %12ld %12ld\n",
+            ph->name, ph->wall, ph->cpu, ph->delta.tokens, ph->delta.nodes,
+            ph->delta.vars, ph->delta.funcs, ph->delta.bytes, ph->peak_rss);
+  }
+  if (cache_dir)
+    fprintf(stderr, "cache: %ld hits, %ld misses\n", stats.cache_hits,
+            stats.cache_misses);
+}
 
 int main(int argc, char **argv) {
-  if (argc != 2)
+  char *cache_arg = NULL;
+  int jobs = 1;
+  bool stream = false;
+  bool pgo = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--stats")) {
+      opt_stats = STATS_TEXT;
+      continue;
+    }
+    if (!strcmp(argv[i], "--stats=json")) {
+      opt_stats = STATS_JSON;
+      continue;
+    }
+    if (!strcmp(argv[i], "--remarks")) {
+      opt_remarks = REMARKS_TEXT;
+      continue;
+    }
+    if (!strcmp(argv[i], "--remarks=json")) {
+      opt_remarks = REMARKS_JSON;
+      continue;
+    }
+    if (!strcmp(argv[i], "-finstrument")) {
+      opt_instrument = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "-fno-cse")) {
+      opt_cse = false;
+      continue;
+    }
+    if (!strcmp(argv[i], "-fno-if-convert")) {
+      opt_if_convert = false;
+      continue;
+    }
+    if (!strcmp(argv[i], "-fprofile-generate")) {
+      opt_profile_generate = true;
+      pgo = true;
+      continue;
+    }
+    if (!strncmp(argv[i], "-fprofile-use=", 14)) {
+      read_profile(argv[i] + 14);
+      pgo = true;
+      continue;
+    }
+    if (!strncmp(argv[i], "--cache-dir=", 12)) {
+      cache_arg = argv[i] + 12;
+      continue;
+    }
+    if (!strcmp(argv[i], "--stream")) {
+      stream = true;
+      continue;
+    }
+    if (!strncmp(argv[i], "-j", 2) && isdigit(argv[i][2])) {
+      jobs = atoi(argv[i] + 2);
+      continue;
+    }
+    if (argv[i][0] == '-')
+      error("%s: unknown argument: %s", argv[0], argv[i]);
+    if (user_input)
+      error("%s: invalid number of arguments", argv[0]);
+    user_input = argv[i];
+  }
+  if (!user_input)
     error("%s: invalid number of arguments", argv[0]);
 
-  // Tokenize and parse.
-  user_input = argv[1];
-  token = tokenize();
-  Function *prog = program();
+  // With a branch profile, branches are laid out by how they were
+  // actually taken rather than replaced by conditional moves.
+  if (pgo)
+    opt_if_convert = false;
 
-  // Assign offsets to local variables.
-  for (Function *fn = prog; fn; fn = fn->next) {
-    int offset = 0;
-    for (VarList *vl = fn->locals; vl; vl = vl->next) {
-      offset += 8;
-      vl->var->offset = offset;
-    }
-    fn->stack_size = offset;
+  // The cache key depends on the codegen options, so this must come
+  // after all of them have been parsed.
+  if (cache_arg)
+    cache_init(cache_arg);
+
+  if (stream) {
+    phase_begin();
+    stream_program();
+    phase_end("stream");
+    if (opt_stats)
+      print_stats();
+    return 0;
   }
 
+  // Tokenize and parse, on several threads if requested. If the
+  // parallel front end gives up, the serial one reports the error.
+  Function *prog = NULL;
+  if (jobs > 1) {
+    phase_begin();
+    prog = parallel_program(jobs);
+    phase_end("frontend");
+  }
+
+  if (!prog) {
+    phase_begin();
+    tokenize();
+    phase_end("tokenize");
+
+    phase_begin();
+    prog = program();
+    phase_end("parse");
+  }
+
+  phase_begin();
+  for (Function *fn = prog; fn; fn = fn->next)
+    optimize(fn);
+  phase_end("optimize");
+
+  phase_begin();
+  for (Function *fn = prog; fn; fn = fn->next)
+    assign_lvar_offsets(fn);
+  phase_end("offsets");
+
   // Traverse the AST to emit assembly.
+  phase_begin();
   codegen(prog);
+  phase_end("codegen");
 
+  if (opt_stats)
+    print_stats();
   return 0;
 }
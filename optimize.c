@@ -0,0 +1,560 @@
+#include "chibicc.h"
+
+// Local value numbering (-fno-cse to disable).
+//
+// Expressions are numbered in evaluation order so that two nodes get
+// the same value number only if they compute the same value. A variable
+// read is keyed by the variable's version, which every assignment to it
+// bumps, and a load through a pointer by the memory epoch, which stores
+// through pointers and calls bump. If any variable has its address
+// taken, variable reads are keyed by the epoch as well. The table is
+// cleared wherever control flow splits or joins, so values are only
+// reused within straight-line code.
+//
+// A repeated computation is then replaced by a read of a temporary,
+// and its first occurrence is rewritten to also assign the temporary:
+//
+//   a*b + a*b  =>  (tmp = a*b) + tmp
+
+bool opt_cse = true;
+
+typedef struct Value Value;
+struct Value {
+  // Key
+  uint8_t kind;
+  TypeId ty;
+  Var *var;
+  uint32_t a, b;
+
+  NodeId first; // First node that computes this value
+  Var *tmp;     // Temporary holding the value once it is reused
+  int reuses;
+};
+
+Value *values;
+int nvalues;
+int values_capa;
+
+uint32_t *vn; // Value number of each node
+
+// Hash table of value numbers. A slot is in use only if its stamp is
+// the current generation, so bumping the generation empties the table.
+uint32_t *table;
+uint32_t *table_gen;
+uint32_t table_mask;
+uint32_t generation;
+
+uint32_t epoch;
+bool escaped;
+int ntemps;
+
+uint32_t new_value(Value *key, NodeId first) {
+  if (nvalues == values_capa) {
+    values_capa = values_capa ? values_capa * 2 : 64;
+    values = realloc(values, values_capa * sizeof(Value));
+  }
+  Value *v = &values[nvalues];
+  *v = *key;
+  v->first = first;
+  v->tmp = NULL;
+  v->reuses = 0;
+  return nvalues++;
+}
+
+// Values with side effects never compare equal to anything.
+uint32_t unique_value(NodeId id) {
+  Value key = {ND_NULL};
+  return new_value(&key, id);
+}
+
+uint32_t hash_value(Value *v) {
+  uint64_t h = v->kind;
+  h = h * 0x9e3779b97f4a7c15 + v->ty;
+  h = h * 0x9e3779b97f4a7c15 + (uintptr_t)v->var;
+  h = h * 0x9e3779b97f4a7c15 + v->a;
+  h = h * 0x9e3779b97f4a7c15 + v->b;
+  return h >> 32;
+}
+
+bool same_value(Value *x, Value *y) {
+  return x->kind == y->kind && x->ty == y->ty && x->var == y->var &&
+         x->a == y->a && x->b == y->b;
+}
+
+// Returns the number of the value described by `key`, or a new number
+// first computed by node `id`.
+uint32_t lookup_value(Value *key, NodeId id) {
+  uint32_t i = hash_value(key) & table_mask;
+  for (;; i = (i + 1) & table_mask) {
+    if (table_gen[i] != generation) {
+      table_gen[i] = generation;
+      table[i] = new_value(key, id);
+      return table[i];
+    }
+    if (same_value(&values[table[i]], key))
+      return table[i];
+  }
+}
+
+bool is_commutative(NodeKind kind) {
+  return kind == ND_ADD || kind == ND_MUL || kind == ND_EQ || kind == ND_NE;
+}
+
+uint32_t number(NodeId id) {
+  Node *node = &pool->nodes[id];
+  Node *lhs;
+  Value key = {node->kind, node->ty};
+
+  switch (node->kind) {
+  case ND_NUM:
+    key.a = node->val;
+    break;
+  case ND_VAR:
+    key.var = node->var;
+    key.a = node->var->version;
+    key.b = escaped ? epoch : 0;
+    break;
+  case ND_ADDR:
+    lhs = &pool->nodes[node->lhs];
+    if (lhs->kind == ND_DEREF)
+      return vn[id] = number(lhs->lhs);
+    key.var = lhs->var;
+    break;
+  case ND_DEREF:
+    key.a = number(node->lhs);
+    key.b = epoch;
+    break;
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE:
+    key.a = number(node->lhs);
+    key.b = number(node->rhs);
+    if (is_commutative(node->kind) && key.a > key.b) {
+      uint32_t tmp = key.a;
+      key.a = key.b;
+      key.b = tmp;
+    }
+    break;
+  case ND_ASSIGN:
+    lhs = &pool->nodes[node->lhs];
+    if (lhs->kind == ND_DEREF)
+      number(lhs->lhs);
+    number(node->rhs);
+    if (lhs->kind == ND_VAR)
+      lhs->var->version++;
+    if (lhs->kind == ND_DEREF || escaped)
+      epoch++;
+    return vn[id] = unique_value(id);
+  case ND_FUNCALL:
+    for (int i = 0; i < node->rhs; i++)
+      number(pool->extra[node->lhs + i]);
+    epoch++;
+    return vn[id] = unique_value(id);
+  case ND_SELECT:
+    number(node->lhs);
+    number(pool->extra[node->rhs]);
+    number(pool->extra[node->rhs + 1]);
+    return vn[id] = unique_value(id);
+  default:
+    return vn[id] = unique_value(id);
+  }
+  return vn[id] = lookup_value(&key, id);
+}
+
+// Forgets all values at a control flow boundary.
+void forget_values() {
+  generation++;
+}
+
+void number_stmt(NodeId id) {
+  Node *node = &pool->nodes[id];
+  switch (node->kind) {
+  case ND_EXPR_STMT:
+  case ND_RETURN:
+    number(node->lhs);
+    return;
+  case ND_BLOCK:
+    for (int i = 0; i < node->rhs; i++)
+      number_stmt(pool->extra[node->lhs + i]);
+    return;
+  case ND_IF: {
+    NodeId then = pool->extra[node->rhs];
+    NodeId els = pool->extra[node->rhs + 1];
+    number(node->lhs);
+    forget_values();
+    number_stmt(then);
+    forget_values();
+    if (els)
+      number_stmt(els);
+    forget_values();
+    return;
+  }
+  case ND_WHILE:
+  case ND_FOR: {
+    NodeId init = 0, cond = node->lhs, inc = 0, then = node->rhs;
+    if (node->kind == ND_FOR) {
+      NodeId *parts = &pool->extra[node->rhs];
+      init = parts[0];
+      cond = parts[1];
+      inc = parts[2];
+      then = parts[3];
+    }
+
+    // Each part may run after any other, so none of them can reuse
+    // another's values.
+    if (init)
+      number_stmt(init);
+    forget_values();
+    if (cond)
+      number(cond);
+    forget_values();
+    number_stmt(then);
+    forget_values();
+    if (inc)
+      number_stmt(inc);
+    forget_values();
+    return;
+  }
+  }
+}
+
+bool is_reusable(NodeKind kind) {
+  switch (kind) {
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE:
+  case ND_DEREF:
+    return true;
+  }
+  return false;
+}
+
+// Makes the first occurrence of value `v` also store it in a new
+// temporary: the node becomes "tmp = <copy of the node>".
+Var *new_temp(Function *fn, Value *v) {
+  char name[20];
+  snprintf(name, sizeof(name), ".cse.%d", ntemps++);
+
+  Var *var = calloc(1, sizeof(Var));
+  var->name = strndup(name, strlen(name));
+  var->ty = v->ty;
+  VarList *vl = calloc(1, sizeof(VarList));
+  stats.vars++;
+  stats.bytes += sizeof(Var) + sizeof(VarList);
+  vl->var = var;
+  vl->next = fn->locals;
+  fn->locals = vl;
+
+  NodeId expr = copy_node(v->first);
+  NodeId lhs = copy_node(v->first);
+  pool->nodes[lhs].kind = ND_VAR;
+  pool->nodes[lhs].var = var;
+
+  Node *node = &pool->nodes[v->first];
+  node->kind = ND_ASSIGN;
+  node->lhs = lhs;
+  node->rhs = expr;
+  return var;
+}
+
+// Replaces every repeated computation under `id` with a read of a
+// temporary.
+void reuse(Function *fn, NodeId id) {
+  Node *node = &pool->nodes[id];
+  if (is_reusable(node->kind)) {
+    Value *v = &values[vn[id]];
+    if (v->first != id) {
+      if (!v->tmp)
+        v->tmp = new_temp(fn, v);
+      v->reuses++;
+      node = &pool->nodes[id];
+      node->kind = ND_VAR;
+      node->var = v->tmp;
+      return;
+    }
+  }
+
+  NodeId lhs = node->lhs;
+  NodeId rhs = node->rhs;
+  switch (node->kind) {
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE:
+    reuse(fn, lhs);
+    reuse(fn, rhs);
+    return;
+  case ND_DEREF:
+    reuse(fn, lhs);
+    return;
+  case ND_ADDR:
+    if (pool->nodes[lhs].kind == ND_DEREF)
+      reuse(fn, pool->nodes[lhs].lhs);
+    return;
+  case ND_ASSIGN:
+    if (pool->nodes[lhs].kind == ND_DEREF)
+      reuse(fn, pool->nodes[lhs].lhs);
+    reuse(fn, rhs);
+    return;
+  case ND_FUNCALL:
+    for (int i = 0; i < rhs; i++)
+      reuse(fn, pool->extra[lhs + i]);
+    return;
+  case ND_SELECT:
+    reuse(fn, lhs);
+    reuse(fn, pool->extra[rhs]);
+    reuse(fn, pool->extra[rhs + 1]);
+    return;
+  }
+}
+
+void reuse_stmt(Function *fn, NodeId id) {
+  Node *node = &pool->nodes[id];
+  switch (node->kind) {
+  case ND_EXPR_STMT:
+  case ND_RETURN:
+    reuse(fn, node->lhs);
+    return;
+  case ND_BLOCK: {
+    // Statements may add nodes and move the pool, so `node` must not
+    // be used after the first one.
+    NodeId body = node->lhs;
+    int n = node->rhs;
+    for (int i = 0; i < n; i++)
+      reuse_stmt(fn, pool->extra[body + i]);
+    return;
+  }
+  case ND_IF: {
+    NodeId then = pool->extra[node->rhs];
+    NodeId els = pool->extra[node->rhs + 1];
+    reuse(fn, node->lhs);
+    reuse_stmt(fn, then);
+    if (els)
+      reuse_stmt(fn, els);
+    return;
+  }
+  case ND_WHILE:
+  case ND_FOR: {
+    NodeId parts[4] = {0, node->lhs, 0, node->rhs};
+    if (node->kind == ND_FOR)
+      memcpy(parts, &pool->extra[node->rhs], sizeof(parts));
+    if (parts[0])
+      reuse_stmt(fn, parts[0]);
+    if (parts[1])
+      reuse(fn, parts[1]);
+    reuse_stmt(fn, parts[3]);
+    if (parts[2])
+      reuse_stmt(fn, parts[2]);
+    return;
+  }
+  }
+}
+
+void cse(Function *fn) {
+  int n = pool->len;
+  vn = calloc(n, sizeof(uint32_t));
+
+  int size = 16;
+  while (size < n * 2)
+    size *= 2;
+  table = calloc(size, sizeof(uint32_t));
+  table_gen = calloc(size, sizeof(uint32_t));
+  table_mask = size - 1;
+  generation = 1;
+  nvalues = 0;
+  ntemps = 0;
+
+  escaped = false;
+  for (int i = 0; i < n; i++) {
+    Node *node = &pool->nodes[i];
+    if (node->kind == ND_ADDR && pool->nodes[node->lhs].kind == ND_VAR)
+      escaped = true;
+  }
+
+  number_stmt(fn->body);
+  reuse_stmt(fn, fn->body);
+
+  for (int i = 0; i < nvalues; i++)
+    if (values[i].reuses)
+      add_remark(fn, pool->nodes[values[i].first].loc,
+                 "common subexpression reused %d time(s)", values[i].reuses);
+
+  free(vn);
+  free(table);
+  free(table_gen);
+}
+
+// If-conversion (-fno-if-convert to disable).
+//
+// An if statement whose arms only choose between two cheap values,
+//
+//   if (c) x = a; else x = b;        =>  x = c ? a : b;
+//   if (c) x = a;                    =>  x = c ? a : x;
+//   if (c) return a; else return b;  =>  return c ? a : b;
+//
+// becomes an ND_SELECT, which codegen emits with cmov or setcc instead
+// of branches. Both values are then always computed, so they must not
+// have side effects or fault: no calls, assignments, loads through
+// pointers or division.
+
+bool opt_if_convert = true;
+
+// The most nodes the two values may have together. Beyond this,
+// computing both costs more than an occasional misprediction.
+int if_convert_limit = 8;
+
+// Looks through blocks of a single statement.
+NodeId single_stmt(NodeId id) {
+  while (id && pool->nodes[id].kind == ND_BLOCK && pool->nodes[id].rhs == 1)
+    id = pool->extra[pool->nodes[id].lhs];
+  return id;
+}
+
+// Returns the number of nodes of `id`, or -1 if it cannot be evaluated
+// speculatively.
+int speculation_cost(NodeId id) {
+  Node *node = &pool->nodes[id];
+  switch (node->kind) {
+  case ND_NUM:
+  case ND_VAR:
+    return 1;
+  case ND_ADDR:
+    return (pool->nodes[node->lhs].kind == ND_VAR) ? 2 : -1;
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE: {
+    int l = speculation_cost(node->lhs);
+    int r = speculation_cost(node->rhs);
+    if (l < 0 || r < 0)
+      return -1;
+    return l + r + 1;
+  }
+  }
+  return -1;
+}
+
+// If statement `id` is "var = expr;", returns the ND_ASSIGN node.
+NodeId var_assign(NodeId id) {
+  if (!id || pool->nodes[id].kind != ND_EXPR_STMT)
+    return 0;
+  NodeId assign = pool->nodes[id].lhs;
+  if (pool->nodes[assign].kind != ND_ASSIGN ||
+      pool->nodes[pool->nodes[assign].lhs].kind != ND_VAR)
+    return 0;
+  return assign;
+}
+
+Var *assigned_var(NodeId assign) {
+  return pool->nodes[pool->nodes[assign].lhs].var;
+}
+
+void if_convert(Function *fn, NodeId id) {
+  Node *node = &pool->nodes[id];
+  NodeId then = single_stmt(pool->extra[node->rhs]);
+  NodeId els = single_stmt(pool->extra[node->rhs + 1]);
+  NodeId then_assign = var_assign(then);
+  NodeId els_assign = var_assign(els);
+  NodeId values[2];
+
+  if (then && els && pool->nodes[then].kind == ND_RETURN &&
+      pool->nodes[els].kind == ND_RETURN) {
+    values[0] = pool->nodes[then].lhs;
+    values[1] = pool->nodes[els].lhs;
+  } else if (then_assign && els_assign &&
+             assigned_var(then_assign) == assigned_var(els_assign)) {
+    values[0] = pool->nodes[then_assign].rhs;
+    values[1] = pool->nodes[els_assign].rhs;
+  } else if (then_assign && !els) {
+    values[0] = pool->nodes[then_assign].rhs;
+    values[1] = pool->nodes[then_assign].lhs; // Keeps the old value
+  } else {
+    return;
+  }
+
+  int a = speculation_cost(values[0]);
+  int b = speculation_cost(values[1]);
+  if (a < 0 || b < 0 || a + b > if_convert_limit ||
+      pool->nodes[values[0]].ty != pool->nodes[values[1]].ty)
+    return;
+
+  // The variable node on the left of the assignment is also an lvalue,
+  // so it is copied to read the old value.
+  if (!els)
+    values[1] = copy_node(values[1]);
+
+  NodeId sel = copy_node(id);
+  NodeId arms = push_extra(values, 2);
+  node = &pool->nodes[sel];
+  node->kind = ND_SELECT;
+  node->ty = pool->nodes[values[0]].ty;
+  node->rhs = arms;
+
+  node = &pool->nodes[id];
+  if (then_assign) {
+    pool->nodes[then_assign].rhs = sel;
+    node->kind = ND_EXPR_STMT;
+    node->lhs = then_assign;
+  } else {
+    node->kind = ND_RETURN;
+    node->lhs = sel;
+  }
+  add_remark(fn, node->loc, "if converted to a conditional move");
+}
+
+void if_convert_stmt(Function *fn, NodeId id) {
+  Node *node = &pool->nodes[id];
+  switch (node->kind) {
+  case ND_BLOCK: {
+    // Conversion adds nodes and may move the pool (see reuse_stmt()).
+    NodeId body = node->lhs;
+    int n = node->rhs;
+    for (int i = 0; i < n; i++)
+      if_convert_stmt(fn, pool->extra[body + i]);
+    return;
+  }
+  case ND_IF: {
+    NodeId then = pool->extra[node->rhs];
+    NodeId els = pool->extra[node->rhs + 1];
+    if_convert_stmt(fn, then);
+    if (els)
+      if_convert_stmt(fn, els);
+    if_convert(fn, id);
+    return;
+  }
+  case ND_WHILE:
+    if_convert_stmt(fn, node->rhs);
+    return;
+  case ND_FOR:
+    if_convert_stmt(fn, pool->extra[node->rhs + 3]);
+    return;
+  }
+}
+
+void optimize(Function *fn) {
+  if (fn->cached_asm)
+    return;
+
+  pool = &fn->pool;
+  if (opt_if_convert)
+    if_convert_stmt(fn, fn->body);
+  if (opt_cse)
+    cse(fn);
+}
@@ -0,0 +1,152 @@
+#include "chibicc.h"
+#include <stdatomic.h>
+#include <threads.h>
+
+// Parallel front end (-jN).
+//
+// Every function ends with the "}" that brings the brace depth back
+// to zero, so a scan over the raw input splits it into one chunk per
+// function without tokenizing it. Worker threads then tokenize and
+// parse the chunks independently; the front end's state is
+// thread-local, and nodes refer to the source by offset, so no state
+// is shared. The resulting functions are linked in source order.
+//
+// If anything goes wrong, parallel_program() returns NULL and the
+// caller compiles serially, which reports exactly the diagnostics it
+// always did.
+
+typedef struct Chunk Chunk;
+struct Chunk {
+  char *start;
+  char *end;
+  Function *fn;
+};
+
+typedef struct Work Work;
+struct Work {
+  Chunk *chunks;
+  int nchunks;
+  atomic_int next;    // Next chunk to hand out
+  atomic_bool failed; // Set if any chunk could not be parsed
+};
+
+typedef struct Worker Worker;
+struct Worker {
+  Work *work;
+  Stats stats; // The worker's counters, merged when it finishes
+};
+
+// Returns the end of the function starting at `p`, i.e. the position
+// after the "}" that brings the brace depth back to zero (or after a
+// stray "}"), or the end of the input if there is no such "}".
+char *function_end(char *p) {
+  int depth = 0;
+  for (; *p; p++) {
+    if (*p == '{')
+      depth++;
+    else if (*p == '}' && --depth <= 0)
+      return p + 1;
+  }
+  return p;
+}
+
+// Splits the input at top-level "}"s. Returns the number of chunks,
+// or -1 if the input is not a sequence of brace-balanced functions.
+int split_functions(Chunk **chunks) {
+  int capa = 16;
+  int n = 0;
+  *chunks = malloc(capa * sizeof(Chunk));
+
+  char *p = user_input;
+  for (;;) {
+    char *q = p;
+    while (isspace(*q))
+      q++;
+    if (!*q)
+      return n;
+
+    char *end = function_end(p);
+    if (end[-1] != '}')
+      return -1;
+
+    if (n == capa) {
+      capa *= 2;
+      *chunks = realloc(*chunks, capa * sizeof(Chunk));
+    }
+    (*chunks)[n++] = (Chunk){p, end};
+    p = end;
+  }
+}
+
+int run_worker(void *arg) {
+  Worker *w = arg;
+  Work *work = w->work;
+
+  jmp_buf jb;
+  error_jmp = &jb;
+  if (setjmp(jb)) {
+    atomic_store(&work->failed, true);
+    w->stats = stats;
+    return 0;
+  }
+
+  for (;;) {
+    int i = atomic_fetch_add(&work->next, 1);
+    if (i >= work->nchunks || atomic_load(&work->failed))
+      break;
+
+    Chunk *c = &work->chunks[i];
+    tokenize_range(c->start, c->end);
+    c->fn = cache_dir ? cached_function() : function();
+    if (!at_eof())
+      error("trailing tokens");
+  }
+
+  w->stats = stats;
+  return 0;
+}
+
+Function *parallel_program(int jobs) {
+  Chunk *chunks;
+  int nchunks = split_functions(&chunks);
+  if (nchunks <= 0)
+    return NULL;
+
+  Work work = {chunks, nchunks};
+  atomic_init(&work.next, 0);
+  atomic_init(&work.failed, false);
+
+  if (jobs > nchunks)
+    jobs = nchunks;
+  Worker *workers = calloc(jobs, sizeof(Worker));
+  thrd_t *threads = calloc(jobs, sizeof(thrd_t));
+
+  int started = 0;
+  for (; started < jobs; started++) {
+    workers[started].work = &work;
+    if (thrd_create(&threads[started], run_worker, &workers[started]) !=
+        thrd_success)
+      break;
+  }
+  if (started == 0)
+    return NULL;
+
+  for (int i = 0; i < started; i++) {
+    thrd_join(threads[i], NULL);
+    Stats *s = &workers[i].stats;
+    stats.tokens += s->tokens;
+    stats.nodes += s->nodes;
+    stats.vars += s->vars;
+    stats.funcs += s->funcs;
+    stats.bytes += s->bytes;
+    stats.cache_hits += s->cache_hits;
+    stats.cache_misses += s->cache_misses;
+  }
+
+  if (atomic_load(&work.failed))
+    return NULL;
+
+  for (int i = 0; i < nchunks - 1; i++)
+    chunks[i].fn->next = chunks[i + 1].fn;
+  return chunks[0].fn;
+}
@@ -1,7 +1,7 @@
 #include "chibicc.h"
 
 // ローカル変数
-VarList *locals;
+_Thread_local VarList *locals;
 
 // Find a local variable by name.
 Var *find_var(Token *tok) {
@@ -17,65 +17,217 @@ Var *find_var(Token *tok) {
 
 // program    = function*
 // function = int ident "(" params? ")" "{" stmt* "}"
-// params   = int ident ("," int ident)*
+// params   = type ident ("," type ident)*
+// type     = int "*"*
 // stmt       =  "return" expr ";"
 //            | "if" "(" expr ")" stmt ("else" stmt)?
 //            | "while" "(" expr ")" stmt
 //            | "for" "(" expr? ";" expr? ";" expr? ")" stmt
 //            | expr ";"
 //            | "{" stmt* "}"
-// expr       = assign
-// assign     = equality ("=" assign)?
-// equality   = relational ("==" relational | "!=" relational)*
-// relational = add ("<" add | "<=" add | ">" add | ">=" add)*
-// add        = mul ("+" mul | "-" mul)*
-// mul        = unary ("*" unary | "/" unary)*
+// expr       = binary
+// binary     = unary (binop binary)*   (see binops for precedence)
 // unary      = ("+" | "-" | "*" | "&")? unary
 //            | primary
 // primary    = "(" expr ")"
 //            | ident func-args?
-//            | int ident
-//            | int ident = assign
+//            | type ident
+//            | type ident = binary
 //            | num
-// func-args = "(" (assign ("," assign)*)? ")"
+// func-args = "(" (expr ("," expr)*)? ")"
+
+// Pool of the function being parsed or generated
+_Thread_local NodePool *pool;
+
+// Children of blocks and calls being parsed. They are collected here
+// and copied to the pool's extra array once the list is complete,
+// because nested lists are parsed in the meantime.
+_Thread_local NodeId *scratch;
+_Thread_local int scratch_len;
+_Thread_local int scratch_capa;
+
+void init_pool(NodePool *p) {
+  p->capa = 64;
+  p->nodes = calloc(p->capa, sizeof(Node));
+  p->nodes[0].kind = ND_NULL;
+  p->len = 1;
+  p->extra = NULL;
+  p->extra_len = p->extra_capa = 0;
+  stats.bytes += p->capa * sizeof(Node);
+}
+
+// Nodes may move when the pool grows, so callers must not hold Node
+// pointers across calls that create nodes.
+NodeId alloc_node() {
+  if (pool->len == pool->capa) {
+    pool->nodes = realloc(pool->nodes, pool->capa * 2 * sizeof(Node));
+    stats.bytes += pool->capa * sizeof(Node);
+    pool->capa *= 2;
+  }
+  stats.nodes++;
+  return pool->len++;
+}
+
+// Appends a copy of node `id` to the pool.
+NodeId copy_node(NodeId id) {
+  NodeId copy = alloc_node();
+  pool->nodes[copy] = pool->nodes[id];
+  return copy;
+}
 
-Node *new_node(NodeKind kind, Token *tok) {
-  Node *node = calloc(1, sizeof(Node));
+NodeId new_node(NodeKind kind, Token *tok) {
+  NodeId id = alloc_node();
+  Node *node = &pool->nodes[id];
   node->kind = kind;
-  node->tok = tok;
-  return node;
+  node->ty = TY_NONE;
+  node->loc = tok->str - user_input;
+  node->lhs = node->rhs = 0;
+  return id;
 }
 
-Node *new_binary(NodeKind kind, Node *lhs, Node *rhs, Token *tok) {
-  Node *node = new_node(kind, tok);
-  node->lhs = lhs;
-  node->rhs = rhs;
-  return node;
+// Sets the type of an expression from its operands, which are always
+// built before it. Statements and calls keep an index into `extra` in
+// `lhs`, so it is only looked up as a node by the kinds that need it.
+void add_type(NodeId id) {
+  Node *node = &pool->nodes[id];
+
+  switch (node->kind) {
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_ASSIGN:
+    node->ty = pool->nodes[node->lhs].ty;
+    return;
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE:
+  case ND_FUNCALL:
+    node->ty = TY_INT;
+    return;
+  case ND_ADDR:
+    node->ty = pointer_to(pool->nodes[node->lhs].ty);
+    return;
+  case ND_DEREF: {
+    TypeId lty = pool->nodes[node->lhs].ty;
+    if (!is_pointer(lty))
+      error_at(user_input + node->loc, "invalid pointer dereference");
+    node->ty = base_type(lty);
+    return;
+  }
+  }
 }
 
-Node *new_unary(NodeKind kind, Node *expr, Token *tok) {
-  Node *node = new_node(kind, tok);
-  node->lhs = expr;
-  return node;
+NodeId new_binary(NodeKind kind, NodeId lhs, NodeId rhs, Token *tok) {
+  NodeId id = new_node(kind, tok);
+  pool->nodes[id].lhs = lhs;
+  pool->nodes[id].rhs = rhs;
+  add_type(id);
+  return id;
 }
 
-Node *new_num(int val, Token *tok) {
-  Node *node = new_node(ND_NUM, tok);
-  node->val = val;
-  return node;
+NodeId new_unary(NodeKind kind, NodeId expr, Token *tok) {
+  NodeId id = new_node(kind, tok);
+  pool->nodes[id].lhs = expr;
+  add_type(id);
+  return id;
 }
 
-Node *new_var(Var *var, Token *tok) {
-  Node *node = new_node(ND_VAR, tok);
-  node->var = var;
-  return node;
+NodeId new_num(int val, Token *tok) {
+  NodeId id = new_node(ND_NUM, tok);
+  pool->nodes[id].ty = TY_INT;
+  pool->nodes[id].val = val;
+  return id;
+}
+
+NodeId new_var(Var *var, Token *tok) {
+  NodeId id = new_node(ND_VAR, tok);
+  pool->nodes[id].ty = var->ty;
+  pool->nodes[id].var = var;
+  return id;
+}
+
+// Pointer arithmetic counts in elements, so the integer operand is
+// scaled by the size of the pointed-to type.
+NodeId new_add(NodeId lhs, NodeId rhs, Token *tok) {
+  TypeId lty = pool->nodes[lhs].ty;
+  TypeId rty = pool->nodes[rhs].ty;
+  if (is_pointer(lty) && is_pointer(rty))
+    error_tok(tok, "invalid operands");
+
+  // num + ptr を ptr + num にする
+  if (is_pointer(rty)) {
+    NodeId tmp = lhs;
+    lhs = rhs;
+    rhs = tmp;
+    lty = rty;
+  }
+  if (is_pointer(lty))
+    rhs = new_binary(ND_MUL, rhs, new_num(size_of(base_type(lty)), tok), tok);
+  return new_binary(ND_ADD, lhs, rhs, tok);
 }
 
-Var *push_var(char *name) {
+NodeId new_sub(NodeId lhs, NodeId rhs, Token *tok) {
+  TypeId lty = pool->nodes[lhs].ty;
+  TypeId rty = pool->nodes[rhs].ty;
+  int size = size_of(base_type(lty));
+
+  // ptr - ptr is the number of elements between them.
+  if (is_pointer(lty) && is_pointer(rty)) {
+    NodeId id = new_binary(ND_SUB, lhs, rhs, tok);
+    pool->nodes[id].ty = TY_INT;
+    return new_binary(ND_DIV, id, new_num(size, tok), tok);
+  }
+  if (is_pointer(rty))
+    error_tok(tok, "invalid operands");
+  if (is_pointer(lty))
+    rhs = new_binary(ND_MUL, rhs, new_num(size, tok), tok);
+  return new_binary(ND_SUB, lhs, rhs, tok);
+}
+
+// Appends `n` ids to the extra array and returns the index of the first.
+// An empty list gets the current end, and the array may still be NULL.
+NodeId push_extra(NodeId *ids, int n) {
+  if (n == 0)
+    return pool->extra_len;
+
+  if (pool->extra_len + n > pool->extra_capa) {
+    int capa = (pool->extra_len + n) * 2;
+    pool->extra = realloc(pool->extra, capa * sizeof(NodeId));
+    stats.bytes += (capa - pool->extra_capa) * sizeof(NodeId);
+    pool->extra_capa = capa;
+  }
+
+  NodeId start = pool->extra_len;
+  memcpy(pool->extra + start, ids, n * sizeof(NodeId));
+  pool->extra_len += n;
+  return start;
+}
+
+void push_scratch(NodeId id) {
+  if (scratch_len == scratch_capa) {
+    scratch_capa = scratch_capa ? scratch_capa * 2 : 64;
+    scratch = realloc(scratch, scratch_capa * sizeof(NodeId));
+  }
+  scratch[scratch_len++] = id;
+}
+
+// Moves the scratch entries from `top` up into the extra array.
+NodeId pop_scratch(int top) {
+  NodeId start = push_extra(scratch + top, scratch_len - top);
+  scratch_len = top;
+  return start;
+}
+
+Var *push_var(char *name, TypeId ty) {
   Var *var = calloc(1, sizeof(Var));
   var->name = name;
+  var->ty = ty;
 
   VarList *vl = calloc(1, sizeof(VarList));
+  stats.vars++;
+  stats.bytes += sizeof(Var) + sizeof(VarList);
   vl->var = var;
   vl->next = locals;
   locals = vl;
@@ -83,15 +235,58 @@ Var *push_var(char *name) {
 }
 
 Function *function();
-Node *stmt();
-Node *expr();
-Node *assign();
-Node *equality();
-Node *relational();
-Node *add();
-Node *mul();
-Node *unary();
-Node *primary();
+NodeId stmt();
+NodeId expr();
+NodeId unary();
+NodeId primary();
+
+// Returns the "}" that closes the function starting at `tok`, or NULL
+// if there is none. Malformed functions are left to function() to
+// diagnose.
+Token *skip_function(Token *tok) {
+  for (; tok->kind != TK_EOF; tok++)
+    if (tok->kind == TK_RESERVED && tok->id == PU_LBRACE)
+      break;
+
+  int depth = 0;
+  for (; tok->kind != TK_EOF; tok++) {
+    if (tok->kind != TK_RESERVED)
+      continue;
+    if (tok->id == PU_LBRACE)
+      depth++;
+    else if (tok->id == PU_RBRACE && --depth == 0)
+      return tok;
+  }
+  return NULL;
+}
+
+// Parses a function unless its output is in the cache, in which case
+// its tokens are skipped and the cached assembly is used instead.
+Function *cached_function() {
+  Token *start = peek();
+  Token *end = skip_function(start);
+  if (!end || start[1].kind != TK_IDENT)
+    return function();
+
+  char *name = strndup(start[1].str, start[1].len);
+  uint64_t key = function_key(start, end, name);
+  char *text = cache_lookup(key);
+  if (!text) {
+    free(name);
+    Function *fn = function();
+    fn->cache_key = key;
+    return fn;
+  }
+
+  Function *fn = calloc(1, sizeof(Function));
+  stats.funcs++;
+  stats.bytes += sizeof(Function);
+  fn->name = name;
+  fn->cache_key = key;
+  fn->cached_asm = text;
+  tokpos = end - tokens + 1;
+  return fn;
+}
 
 // program = function*
 Function *program() {
@@ -100,26 +295,69 @@ Function *program() {
   Function *cur = &head;
 
   while (!at_eof()) {
-    cur->next = function();
+    cur->next = cache_dir ? cached_function() : function();
     cur = cur->next;
   }
   return head.next;
 }
 
+// Releases a function and everything the parser allocated for it.
+// Parameters are also on the locals list, so only their list cells are
+// freed separately.
+void free_function(Function *fn) {
+  for (VarList *vl = fn->params; vl;) {
+    VarList *next = vl->next;
+    free(vl);
+    vl = next;
+  }
+  for (VarList *vl = fn->locals; vl;) {
+    VarList *next = vl->next;
+    free(vl->var->name);
+    free(vl->var);
+    free(vl);
+    vl = next;
+  }
+  for (Remark *r = fn->remarks; r;) {
+    Remark *next = r->next;
+    free(r->msg);
+    free(r);
+    r = next;
+  }
+  free(fn->pool.nodes);
+  free(fn->pool.extra);
+  free(fn->cached_asm);
+  free(fn->name);
+  free(fn);
+}
+
+// type = int "*"*
+//
+// The "int" has already been consumed.
+TypeId read_pointers() {
+  TypeId ty = TY_INT;
+  while (consume(PU_MUL))
+    ty = pointer_to(ty);
+  return ty;
+}
+
 VarList *read_func_params() {
-  if (consume(")"))
+  if (consume(PU_RPAREN))
     return NULL;
 
-  expect("int");
+  expect(KW_INT);
   VarList *head = calloc(1, sizeof(VarList));
-  head->var = push_var(expect_ident());
+  stats.bytes += sizeof(VarList);
+  TypeId ty = read_pointers();
+  head->var = push_var(expect_ident(), ty);
   VarList *cur = head;
 
-  while (!consume(")")) {
-    expect(",");
-    expect("int");
+  while (!consume(PU_RPAREN)) {
+    expect(PU_COMMA);
+    expect(KW_INT);
     cur->next = calloc(1, sizeof(VarList));
-    cur->next->var = push_var(expect_ident());
+    stats.bytes += sizeof(VarList);
+    ty = read_pointers();
+    cur->next->var = push_var(expect_ident(), ty);
     cur = cur->next;
   }
 
@@ -127,32 +365,35 @@ VarList *read_func_params() {
 }
 
 // function = int ident "(" params? ")" "{" stmt* "}"
-// params   = int ident ("," int ident)*
+// params   = type ident ("," type ident)*
 Function *function() {
   locals = NULL;
 
   Function *fn = calloc(1, sizeof(Function));
-  expect("int");
+  stats.funcs++;
+  stats.bytes += sizeof(Function);
+  init_pool(&fn->pool);
+  pool = &fn->pool;
+
+  expect(KW_INT);
   fn->name = expect_ident();
-  expect("(");
+  expect(PU_LPAREN);
   fn->params = read_func_params();
-  expect("{");
+  Token *tok = peek();
+  expect(PU_LBRACE);
 
-  Node head;
-  head.next = NULL;
-  Node *cur = &head;
-  while (!consume("}")) {
-    cur->next = stmt();
-    cur = cur->next;
-  }
+  int top = scratch_len;
+  while (!consume(PU_RBRACE))
+    push_scratch(stmt());
+  int n = scratch_len - top;
+  fn->body = new_binary(ND_BLOCK, pop_scratch(top), n, tok);
 
-  fn->node = head.next;
   fn->locals = locals;
   return fn;
 }
 
-Node *read_expr_stmt() {
-  Token *tok = token;
+NodeId read_expr_stmt() {
+  Token *tok = peek();
   return new_unary(ND_EXPR_STMT, expr(), tok);
 }
 
@@ -162,211 +403,194 @@ Node *read_expr_stmt() {
 //      | "for" "(" expr? ";" expr? ";" expr? ")" stmt
 //      | "{" stmt* "}"
 //      | expr ";"
-Node *stmt() {
+NodeId stmt() {
   Token *tok;
-  if (tok = consume("return")) {
-    Node *node = new_unary(ND_RETURN, expr(), tok);
-    expect(";");
+  if (tok = consume(KW_RETURN)) {
+    NodeId node = new_unary(ND_RETURN, expr(), tok);
+    expect(PU_SEMI);
     return node;
   }
 
-  if (tok = consume("if")) {
-    Node *node = new_node(ND_IF, tok);
-    expect("(");
-    node->cond = expr();
-    expect(")");
-    node->then = stmt();
-    if (consume("else"))
-      node->els = stmt();
-    return node;
+  if (tok = consume(KW_IF)) {
+    expect(PU_LPAREN);
+    NodeId cond = expr();
+    expect(PU_RPAREN);
+    NodeId arms[2] = {stmt(), 0};
+    if (consume(KW_ELSE))
+      arms[1] = stmt();
+    return new_binary(ND_IF, cond, push_extra(arms, 2), tok);
   }
 
-  if (tok = consume("while")) {
-    Node *node = new_node(ND_WHILE, tok);
-    expect("(");
-    node->cond = expr();
-    expect(")");
-    node->then = stmt();
-    return node;
+  if (tok = consume(KW_WHILE)) {
+    expect(PU_LPAREN);
+    NodeId cond = expr();
+    expect(PU_RPAREN);
+    return new_binary(ND_WHILE, cond, stmt(), tok);
   }
 
-  if (tok = consume("for")) {
-    Node *node = new_node(ND_FOR, tok);
-    expect("(");
-    if (!consume(";")) {
-      node->init = read_expr_stmt();
-      expect(";");
+  if (tok = consume(KW_FOR)) {
+    NodeId parts[4] = {0}; // init, cond, inc, then
+    expect(PU_LPAREN);
+    if (!consume(PU_SEMI)) {
+      parts[0] = read_expr_stmt();
+      expect(PU_SEMI);
     }
-    if (!consume(";")) {
-      node->cond = expr();
-      expect(";");
+    if (!consume(PU_SEMI)) {
+      parts[1] = expr();
+      expect(PU_SEMI);
     }
-    if (!consume(")")) {
-      node->inc = read_expr_stmt();
-      expect(")");
+    if (!consume(PU_RPAREN)) {
+      parts[2] = read_expr_stmt();
+      expect(PU_RPAREN);
     }
-    node->then = stmt();
-    return node;
+    parts[3] = stmt();
+    return new_binary(ND_FOR, 0, push_extra(parts, 4), tok);
   }
 
-  if (tok = consume("{")) {
-    Node head;
-    head.next = NULL;
-    Node *cur = &head;
-
-    while (!consume("}")) {
-      cur->next = stmt();
-      cur = cur->next;
-    }
-
-    Node *node = new_node(ND_BLOCK, tok);
-    node->body = head.next;
-    return node;
+  if (tok = consume(PU_LBRACE)) {
+    int top = scratch_len;
+    while (!consume(PU_RBRACE))
+      push_scratch(stmt());
+    int n = scratch_len - top;
+    return new_binary(ND_BLOCK, pop_scratch(top), n, tok);
   }
 
-  Node *node = read_expr_stmt();
-  expect(";");
+  NodeId node = read_expr_stmt();
+  expect(PU_SEMI);
   return node;
 }
 
-// expr = assign
-Node *expr() {
-  return assign();
-}
-
-// assign = equality ("=" assign)?
-Node *assign() {
-  Node *node = equality();
-  Token *tok;
-  if (tok = consume("="))
-    node = new_binary(ND_ASSIGN, node, assign(), tok);
-  return node;
-}
-
-// equality = relational ("==" relational | "!=" relational)*
-Node *equality() {
-  Node *node = relational();
-  Token *tok;
+// Binary operators are parsed by precedence climbing, driven by this
+// table indexed by token id. Tokens without an entry (prec 0) end an
+// expression. A new operator only needs a token id and an entry here,
+// plus a level in Prec if none of the existing ones fits.
+typedef enum {
+  PREC_NONE,
+  PREC_ASSIGN,     // =
+  PREC_EQUALITY,   // == !=
+  PREC_RELATIONAL, // < <= > >=
+  PREC_ADD,        // + -
+  PREC_MUL,        // * /
+} Prec;
+
+typedef struct BinOp BinOp;
+struct BinOp {
+  Prec prec;
+  NodeKind kind;
+  bool swap;  // Operands are swapped (a > b is b < a)
+  bool right; // Right-associative
+};
+
+BinOp binops[NUM_RESERVED] = {
+  [PU_ASSIGN] = {PREC_ASSIGN, ND_ASSIGN, false, true},
+  [PU_EQ] = {PREC_EQUALITY, ND_EQ},
+  [PU_NE] = {PREC_EQUALITY, ND_NE},
+  [PU_LT] = {PREC_RELATIONAL, ND_LT},
+  [PU_LE] = {PREC_RELATIONAL, ND_LE},
+  [PU_GT] = {PREC_RELATIONAL, ND_LT, true}, // >= と > は左辺と右辺を入れ替え使いまわす
+  [PU_GE] = {PREC_RELATIONAL, ND_LE, true},
+  [PU_ADD] = {PREC_ADD, ND_ADD},
+  [PU_SUB] = {PREC_ADD, ND_SUB},
+  [PU_MUL] = {PREC_MUL, ND_MUL},
+  [PU_DIV] = {PREC_MUL, ND_DIV},
+};
+
+// binary = unary (binop binary)*
+//
+// Parses operators of precedence `min_prec` or higher.
+NodeId binary(Prec min_prec) {
+  NodeId node = unary();
 
   for (;;) {
-    if (tok = consume("=="))
-      node = new_binary(ND_EQ, node, relational(), tok);
-    else if (tok = consume("!="))
-      node = new_binary(ND_NE, node, relational(), tok);
-    else
+    Token *tok = peek();
+    if (tok->kind != TK_RESERVED)
       return node;
-  }
-}
-
-// relational = add ("<" add | "<=" add | ">" add | ">=" add)*
-Node *relational() {
-  Node *node = add();
-  Token *tok;
-
-  for (;;) {
-    if (tok = consume("<"))
-      node = new_binary(ND_LT, node, add(), tok);
-    else if (tok = consume("<="))
-      node = new_binary(ND_LE, node, add(), tok);
-    else if (tok = consume(">")) // >= と > は左辺と右辺を入れ替え使いまわす
-      node = new_binary(ND_LT, add(), node, tok);
-    else if (tok = consume(">="))
-      node = new_binary(ND_LE, add(), node, tok);
-    else
+    BinOp *op = &binops[tok->id];
+    if (op->prec == PREC_NONE || op->prec < min_prec)
       return node;
-  }
-}
-
-// add = mul ("+" mul | "-" mul)*
-Node *add() {
-  Node *node = mul();
-  Token *tok;
-
-  for (;;) {
-    if (tok = consume("+"))
-      node = new_binary(ND_ADD, node, mul(), tok);
-    else if (tok = consume("-"))
-      node = new_binary(ND_SUB, node, mul(), tok);
+    tokpos++;
+
+    NodeId rhs = binary(op->right ? op->prec : op->prec + 1);
+    if (op->swap)
+      node = new_binary(op->kind, rhs, node, tok);
+    else if (op->kind == ND_ADD)
+      node = new_add(node, rhs, tok);
+    else if (op->kind == ND_SUB)
+      node = new_sub(node, rhs, tok);
     else
-      return node;
+      node = new_binary(op->kind, node, rhs, tok);
   }
 }
 
-// mul = unary ("*" unary | "/" unary)*
-Node *mul() {
-  Node *node = unary();
-  Token *tok;
-
-  for (;;) {
-    if (tok = consume("*"))
-      node = new_binary(ND_MUL, node, unary(), tok);
-    else if (tok = consume("/"))
-      node = new_binary(ND_DIV, node, unary(), tok);
-    else
-      return node;
-  }
+// expr = binary(PREC_ASSIGN)
+NodeId expr() {
+  return binary(PREC_ASSIGN);
 }
 
 // unary = ("+" | "-" | "*" | "&")? unary
 //       | primary
-Node *unary() {
+NodeId unary() {
   Token *tok;
-  if (consume("+"))
+  if (consume(PU_ADD))
     return unary();
-  if (tok = consume("-"))
-    return new_binary(ND_SUB, new_num(0, tok), unary(), tok);
-  if (tok = consume("&"))
+  if (tok = consume(PU_SUB))
+    return new_sub(new_num(0, tok), unary(), tok);
+  if (tok = consume(PU_AMP))
     return new_unary(ND_ADDR, unary(), tok);
-  if (tok = consume("*"))
+  if (tok = consume(PU_MUL))
     return new_unary(ND_DEREF, unary(), tok);
 
   return primary();
 }
 
-// func-args = "(" (assign ("," assign)*)? ")"
-Node *func_args() {
-  if (consume(")"))
-    return NULL; // no argument
-
-  Node *head = assign();
-  Node *cur = head;
-  while (consume(",")) {
-    cur->next = assign();
-    cur = cur->next;
+// func-args = "(" (expr ("," expr)*)? ")"
+//
+// Pushes the arguments onto the scratch stack and returns their number.
+int func_args() {
+  if (consume(PU_RPAREN))
+    return 0; // no argument
+
+  int n = 1;
+  push_scratch(expr());
+  while (consume(PU_COMMA)) {
+    push_scratch(expr());
+    n++;
   }
-  expect(")");
-  return head;
+  expect(PU_RPAREN);
+  return n;
 }
 
 // primary    = "(" expr ")"
 //            | ident func-args?
-//            | int ident
-//            | int ident = primary
+//            | type ident
+//            | type ident = binary
 //            | num
-Node *primary() {
+NodeId primary() {
   // 次のトークンが"("なら、"(" expr ")"のはず
-  if (consume("(")) {
-    Node *node = expr();
-    expect(")");
+  if (consume(PU_LPAREN)) {
+    NodeId node = expr();
+    expect(PU_RPAREN);
     return node;
   }
 
   Token *tok;
-  if (consume("int")) {
+  if (consume(KW_INT)) {
     // variable declaration
+    TypeId ty = read_pointers();
     tok = expect_ident_tok();
     if (find_var(tok))
       error_tok(tok, "already declared variable");
     
     // ローカル変数を追加
-    Var *var = push_var(strndup(tok->str, tok->len));
-    Node *lvar = new_var(var, tok);
+    Var *var = push_var(strndup(tok->str, tok->len), ty);
+    NodeId lvar = new_var(var, tok);
 
     // 初期化式だった場合 (int X = 1)
     // TODO: このprimary()の配置でいいのか？
-    if (tok = consume("=")) {
+    Token *eq;
+    if (eq = consume(PU_ASSIGN)) {
       // TODO: equalityとassignどっちがいいのか
-      Node *node = new_binary(ND_ASSIGN, lvar, equality(), tok);
+      NodeId node = new_binary(ND_ASSIGN, lvar, binary(PREC_EQUALITY), eq);
 
       return node;
     }
@@ -376,12 +600,11 @@ Node *primary() {
   }
 
   if (tok = consume_ident()) {
-    if (consume("(")) {
+    if (consume(PU_LPAREN)) {
       // function call
-      Node *node = new_node(ND_FUNCALL, tok);
-      node->funcname = strndup(tok->str, tok->len);
-      node->args = func_args();
-      return node;
+      int top = scratch_len;
+      int nargs = func_args();
+      return new_binary(ND_FUNCALL, pop_scratch(top), nargs, tok);
     }
     // variable
     Var *var = find_var(tok);
@@ -390,7 +613,7 @@ Node *primary() {
     return new_var(var, tok);
   }
 
-  tok = token;
+  tok = peek();
   if (tok->kind != TK_NUM)
     error_tok(tok, "expected expression");
   // そうでなければ数値のはず
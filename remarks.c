@@ -0,0 +1,225 @@
+#include "chibicc.h"
+
+// Code quality report (--remarks).
+//
+// For every function we report what the generated assembly consists
+// of, plus free-form remarks that passes attach to the function with
+// add_remark(). The metrics are taken from the assembly text itself,
+// so they are the same whether a function was generated or taken from
+// the cache.
+
+RemarksFormat opt_remarks;
+
+// Attaches a remark about the code at offset `loc` of the input. It is
+// reported as a line and column (see remark_pos()).
+void add_remark(Function *fn, uint32_t loc, char *fmt, ...) {
+  if (!opt_remarks)
+    return;
+
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+
+  Remark *r = calloc(1, sizeof(Remark));
+  r->loc = loc;
+  r->msg = malloc(len + 1);
+  va_start(ap, fmt);
+  vsnprintf(r->msg, len + 1, fmt, ap);
+  va_end(ap);
+
+  // Keep remarks in the order they were made.
+  Remark **p = &fn->remarks;
+  while (*p)
+    p = &(*p)->next;
+  *p = r;
+}
+
+// Lines are not NUL-terminated, so prefixes are checked against `len`.
+bool has_prefix(char *line, int len, char *q) {
+  int n = strlen(q);
+  return n <= len && !memcmp(line, q, n);
+}
+
+bool has_any_prefix(char *line, int len, char **qs) {
+  for (; *qs; qs++)
+    if (has_prefix(line, len, *qs))
+      return true;
+  return false;
+}
+
+// Instructions that only read a memory destination or sole operand,
+// and those that only write it. Any other instruction with a memory
+// destination, such as inc or add, reads and writes it.
+char *mem_read_only[] = {"push ", "cmp ",  "test ", "idiv ",
+                         "div ",  "imul ", "mul ",  NULL};
+char *mem_write_only[] = {"mov ", "pop ", NULL};
+
+// Counts the memory accesses of one instruction. lea only computes an
+// address, and a memory source operand is always a load.
+void count_memory(CodeMetrics *m, char *line, int len) {
+  char *mem = memchr(line, '[', len);
+  if (!mem || has_prefix(line, len, "lea "))
+    return;
+
+  char *comma = memchr(line, ',', len);
+  if (comma && comma < mem) {
+    m->loads++;
+    return;
+  }
+  if (!has_any_prefix(line, len, mem_write_only))
+    m->loads++;
+  if (!has_any_prefix(line, len, mem_read_only))
+    m->stores++;
+}
+
+// Classifies one line of assembly.
+void count_line(CodeMetrics *m, char *line, int len, bool *in_text) {
+  if (len == 0)
+    return;
+
+  // Labels
+  if (line[0] != ' ') {
+    if (*in_text && line[len - 1] == ':' && has_prefix(line, len, ".L"))
+      m->labels++;
+    return;
+  }
+
+  while (*line == ' ') {
+    line++;
+    len--;
+  }
+
+  // Directives
+  if (line[0] == '.') {
+    if (has_prefix(line, len, ".text"))
+      *in_text = true;
+    else if (has_prefix(line, len, ".section"))
+      *in_text = false;
+    return;
+  }
+
+  m->insns++;
+  count_memory(m, line, len);
+
+  if (has_prefix(line, len, "push ") || has_prefix(line, len, "pop ")) {
+    m->pushpop++;
+    return;
+  }
+  if (has_prefix(line, len, "call ")) {
+    m->calls++;
+    return;
+  }
+  if (line[0] == 'j') {
+    m->branches++;
+    return;
+  }
+
+  // The frame is allocated by the first "sub rsp" of the prologue.
+  if (m->frame_size < 0 && has_prefix(line, len, "sub rsp, "))
+    m->frame_size = atoi(line + 9);
+}
+
+// Computes the metrics of a function's assembly.
+void count_code(Function *fn, char *text, int len) {
+  CodeMetrics *m = &fn->metrics;
+  *m = (CodeMetrics){0};
+  m->frame_size = -1;
+
+  bool in_text = true;
+  for (char *end = text + len; text < end;) {
+    char *nl = memchr(text, '\n', end - text);
+    if (!nl)
+      nl = end;
+    count_line(m, text, nl - text, &in_text);
+    text = nl + 1;
+  }
+}
+
+void print_json_string(char *s) {
+  fputc('"', stderr);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(stderr, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(stderr, "\\u%04x", *s);
+    else
+      fputc(*s, stderr);
+  }
+  fputc('"', stderr);
+}
+
+// Offsets in user_input at which each line starts. The table is built
+// on the first remark so that every later lookup is a binary search.
+uint32_t *line_starts;
+int nlines;
+
+// Converts an offset in user_input to a 1-based line and column.
+void remark_pos(uint32_t loc, int *line, int *col) {
+  if (!line_starts) {
+    int capa = 64;
+    line_starts = malloc(capa * sizeof(uint32_t));
+    line_starts[nlines++] = 0;
+    for (char *p = user_input; *p; p++) {
+      if (*p != '\n')
+        continue;
+      if (nlines == capa) {
+        capa *= 2;
+        line_starts = realloc(line_starts, capa * sizeof(uint32_t));
+      }
+      line_starts[nlines++] = p + 1 - user_input;
+    }
+  }
+
+  // Find the last line that starts at or before `loc`.
+  int lo = 0, hi = nlines - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (line_starts[mid] <= loc)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  *line = lo + 1;
+  *col = loc - line_starts[lo] + 1;
+}
+
+// Prints the report of one function to stderr. The JSON form is one
+// object per line so that it can be emitted as functions are finished.
+void print_remarks(Function *fn) {
+  CodeMetrics *m = &fn->metrics;
+
+  if (opt_remarks == REMARKS_JSON) {
+    fprintf(stderr, "{\"function\":");
+    print_json_string(fn->name);
+    fprintf(stderr,
+            ",\"frame_size\":%d,\"insns\":%d,\"pushpop\":%d,\"loads\":%d,"
+            "\"stores\":%d,\"branches\":%d,\"calls\":%d,\"labels\":%d,"
+            "\"cached\":%s,\"remarks\":[",
+            m->frame_size, m->insns, m->pushpop, m->loads, m->stores,
+            m->branches, m->calls, m->labels,
+            fn->cached_asm ? "true" : "false");
+    for (Remark *r = fn->remarks; r; r = r->next) {
+      int line, col;
+      remark_pos(r->loc, &line, &col);
+      fprintf(stderr, "%s{\"line\":%d,\"col\":%d,\"msg\":",
+              r == fn->remarks ? "" : ",", line, col);
+      print_json_string(r->msg);
+      fprintf(stderr, "}");
+    }
+    fprintf(stderr, "]}\n");
+    return;
+  }
+
+  fprintf(stderr,
+          "%s:%s frame %d bytes, %d insns (push/pop %d, loads %d, stores %d, "
+          "branches %d, calls %d), %d labels\n",
+          fn->name, fn->cached_asm ? " (cached)" : "", m->frame_size,
+          m->insns, m->pushpop, m->loads, m->stores, m->branches, m->calls,
+          m->labels);
+  for (Remark *r = fn->remarks; r; r = r->next) {
+    int line, col;
+    remark_pos(r->loc, &line, &col);
+    fprintf(stderr, "%s:%d:%d: remark: %s\n", fn->name, line, col, r->msg);
+  }
+}
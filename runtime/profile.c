@@ -0,0 +1,53 @@
+// Runtime support for code compiled with `chibicc -finstrument` or
+// `chibicc -fprofile-generate`.
+//
+// Every instrumented function and branch owns ProfRecords in the
+// __chibicc_prof section. The linker concatenates those records from
+// all objects and defines __start___chibicc_prof/__stop___chibicc_prof
+// around them, so we can walk the table without any registration at
+// startup.
+// The table is written out when the program exits.
+#include <stdio.h>
+#include <stdlib.h>
+
+// Must match the records emitted by codegen.c.
+typedef struct ProfRecord ProfRecord;
+struct ProfRecord {
+  char *name;  // Function name
+  int seq;     // Branch label number, or -1 for the function itself
+  int arm;     // 0: branch condition evaluated, 1: condition true
+  long count;  // Times the function or branch arm was entered
+  long cycles; // Inclusive TSC cycles spent in the function
+};
+
+extern ProfRecord __start___chibicc_prof[] __attribute__((weak));
+extern ProfRecord __stop___chibicc_prof[] __attribute__((weak));
+
+static char *prof_path;
+
+__attribute__((constructor))
+static void prof_init(void) {
+  prof_path = getenv("CHIBICC_PROF");
+  if (!prof_path)
+    prof_path = "chibicc.prof";
+}
+
+__attribute__((destructor))
+static void prof_dump(void) {
+  if (__start___chibicc_prof == __stop___chibicc_prof)
+    return;
+
+  FILE *fp = fopen(prof_path, "w");
+  if (!fp) {
+    perror(prof_path);
+    return;
+  }
+
+  for (ProfRecord *r = __start___chibicc_prof; r < __stop___chibicc_prof; r++) {
+    if (r->seq < 0)
+      fprintf(fp, "func %s %ld %ld\n", r->name, r->count, r->cycles);
+    else
+      fprintf(fp, "edge %s %d %d %ld\n", r->name, r->seq, r->arm, r->count);
+  }
+  fclose(fp);
+}
@@ -14,6 +14,10 @@ int add6(int a, int b, int c, int d, int e, int f) {
   return a+b+c+d+e+f;
 }
 
+int sub8(int a, int b, int c, int d, int e, int f, int g, int h) {
+  return a+b+c+d+e+f+g-h;
+}
+
 void hello(void) {
   printf("Hello world\n");
 }
@@ -101,6 +105,9 @@ assert 10 'int main() { int i=0; while(i<10) i=i+1; return i; }'
 # for
 assert 55 'int main() { int i=0; int j=0; for (i=0; i<=10; i=i+1) j=i+j; return j; }'
 assert 3 'int main() { for (;;) return 3; return 5; }'
+# statements keep more entries in the extra array than there are nodes
+loops=$(printf 'for (;0;) {} %.0s' $(seq 40))
+assert 0 "int main() { $loops return 0; }"
 
 # block while
 assert 55 'int main() { int i=0; int j=0; while(i<=10) {j=i+j; i=i+1;} return j; }'
@@ -137,6 +144,13 @@ assert 21 'int my_add6(int a, int b, int c, int d, int e, int f) { return a + b
 
 assert 7 'int unused(int i, int j, int k) { int a = 2; return a + j + k; } int main() { return unused(1, 2, 3); }'
 
+# more than 6 arguments
+assert 20 'int main() { return sub8(1, 2, 3, 4, 5, 6, 7, 8); }'
+assert 20 'int main() { int a=1; int h=8; return sub8(a, 1+1, ret3(), 4, ret5(), 6, add(3, 4), h); }'
+assert 20 'int my_sub8(int a, int b, int c, int d, int e, int f, int g, int h) { return a+b+c+d+e+f+g-h; } int main() { return my_sub8(1, 2, 3, 4, 5, 6, 7, 8); }'
+assert 8 'int f7(int a, int b, int c, int d, int e, int f, int *g) { return *g + a; } int main() { int x=7; return f7(1, 0, 0, 0, 0, 0, &x); }'
+assert 2 'int f7(int a, int b, int c, int d, int e, int f, int g) { hello(); return g-f; } int main() { return f7(1, 2, 3, 4, 5, 6, 8); }'
+
 # recursive fibonacci 
 assert 1 'int fib(int n) { if (n < 2) { return n; } return fib(n-2) + fib(n-1); } int main() { return fib(1); }'
 assert 55 'int fib(int n) { if (n < 2) { return n; } return fib(n-2) + fib(n-1); } int main() { return fib(10); }'
@@ -144,11 +158,188 @@ assert 233 'int fib(int n) { if (n < 2) { return n; } return fib(n-2) + fib(n-1)
 
 # unary &, *
 assert 3 'int main() { int x=3; *&x; }'
-# assert 3 'int main() { int x=3; int *y=&x; z=&y; return **z; }'
-assert 5 'int main() { int x=3; int y=5; return *(&x+8); }'
-assert 3 'int main() { int x=3; int y=5; return *(&y-8); }'
-# assert 5 'int main() { int x=3; int *y=&x; *y=5; return x; }'
-assert 7 'int main() { int x=3; int y=5; *(&x+8)=7; return y; }'
-assert 7 'int main() { int x=3; int y=5; *(&y-8)=7; return x; }'
+assert 3 'int main() { int x=3; int *y=&x; int **z=&y; return **z; }'
+assert 5 'int main() { int x=3; int y=5; return *(&x+1); }'
+assert 3 'int main() { int x=3; int y=5; return *(&y-1); }'
+assert 5 'int main() { int x=3; int *y=&x; *y=5; return x; }'
+assert 7 'int main() { int x=3; int y=5; *(&x+1)=7; return y; }'
+assert 7 'int main() { int x=3; int y=5; *(&y-1)=7; return x; }'
+assert 5 'int main() { int x=3; int y=5; return *(1+&x); }'
+assert 1 'int main() { int x; int y; return &y-&x; }'
+assert 7 'int deref(int *p) { return *p; } int main() { int x=7; return deref(&x); }'
+
+# int is 32 bits
+assert 1 'int main() { int x=2147483647; return x+1 < 0; }'
+
+# instruction patterns
+assert 4 'int main() { int a=12; int b=3; return a/b; }'
+assert 1 'int main() { int a=3; return (a>2)+(a>=4)+(2>a)+(3>=a)-1; }'
+assert 5 'int main() { int x=3; int y=5; int i=1; return *(&x+i); }'
+assert 3 'int main() { int x=3; int y=5; int i=1; return *(&y-i); }'
+assert 9 'int main() { int x=3; int *p=&x; *p=9; return x; }'
+assert 8 'int main() { int x=3; int *p=&x; return *(p+0)+5; }'
+
+# if-conversion
+assert 5 'int main() { int x=3; int y; if (x<4) y=5; else y=7; return y; }'
+assert 7 'int main() { int x=5; int y; if (x<4) y=5; else y=7; return y; }'
+assert 2 'int f(int x) { if (x<3) return 1; else return 2; } int main() { return f(5); }'
+assert 1 'int main() { int x=3; int y=9; if (x<4) { y=1; } return y; }'
+assert 9 'int main() { int x=5; int y=9; if (x<4) y=1; return y; }'
+assert 4 'int main() { int x=3; int y; if (x==3) y=0; else y=1; return y+4; }'
+assert 3 'int main() { int x=1; int y; if (x) y=ret3(); else y=2; return y; }'
+assert 5 'int main() { int x=0; int *p=&x; int y; if (x) y=*p; else y=5; return y; }'
+# conversion grows the node pool while blocks are being rewritten
+assert 2 'int main() { int a=1; int b=2; int x; a=1; a=1; a=1; a=1; a=1; { x = a*b + a*b; if (a<b) x=1; else x=2; x = b*a; } return x; }'
+
+# common subexpressions
+assert 24 'int main() { int a=3; int b=4; return a*b+b*a; }'
+assert 19 'int main() { int a=3; int b=4; int c=a*b; a=1; return c+a*b+3; }'
+assert 10 'int main() { int x=3; int *p=&x; int y=*p+1; *p=5; return y+*p+1; }'
+assert 12 'int main() { int i=0; int s=0; while (i*2<8) { s=s+i*2; i=i+1; } return s-i*2+8; }'
+# temporaries grow the node pool while blocks are being rewritten
+assert 1 'int main() { int a=1; int b=2; int x; a=1; a=1; a=1; a=1; a=1; x = a*b + a*b; x = b - a; x = (b-a)*(b-a); return x; }'
+
+# -finstrument
+./chibicc -finstrument 'int fib(int n) { if (n < 2) { return n; } return fib(n-2) + fib(n-1); } int main() { return fib(10); }' > tmp.s
+gcc -o tmp tmp.s runtime/profile.o
+CHIBICC_PROF=tmp.prof ./tmp
+if grep -q '^func fib 177 ' tmp.prof && grep -q '^func main 1 ' tmp.prof; then
+  echo "-finstrument => ok"
+else
+  echo "-finstrument => unexpected profile:"
+  cat tmp.prof
+  exit 1
+fi
+
+# -fprofile-generate / -fprofile-use
+pgo='int f(int x) { if (x < 3) return 1; else return 2; } int main() { int i=0; int s=0; while (i<100) { s = s + f(i); i = i + 1; } return s - 100; }'
+./chibicc -fprofile-generate "$pgo" > tmp.s
+gcc -o tmp tmp.s runtime/profile.o
+CHIBICC_PROF=tmp.prof ./tmp
+./chibicc -fprofile-use=tmp.prof "$pgo" > tmp.s
+gcc -o tmp tmp.s tmp2.o
+./tmp
+actual="$?"
+if [ "$actual" = 97 ] && grep -q 'jne .Lthen' tmp.s; then
+  echo "-fprofile-use => ok"
+else
+  echo "-fprofile-use => 97 with the cold then-arm out of line expected, but got $actual"
+  exit 1
+fi
+
+# -fprofile-use with nested branches: each if must get its own counters
+# even when the cold then-arm is moved out of line, and remarks point
+# at the line and column of the branch
+nested='int f(int x) {
+  if (x<3) {
+    if (x==1) return 3; return 0; } else { if (x==50) return 5; return 0; } }
+int main() { int i=0; int s=0; while (i<100) { s = s + f(i); i = i + 1; } return s; }'
+./chibicc -fprofile-generate "$nested" > tmp.s
+gcc -o tmp tmp.s runtime/profile.o
+CHIBICC_PROF=tmp.prof ./tmp
+./chibicc --remarks -fprofile-use=tmp.prof "$nested" 2> tmp.stats > /dev/null
+if grep -q "^f:3:5: remark: then-arm moved out of line (taken 1 of 3)" tmp.stats; then
+  echo "-fprofile-use nested => ok"
+else
+  echo "-fprofile-use nested => inner if laid out with another branch's counters"
+  cat tmp.stats
+  exit 1
+fi
+
+# --stats
+stats='int fib(int n) { if (n < 2) { return n; } return fib(n-2) + fib(n-1); } int main() { return fib(10); }'
+./chibicc --stats "$stats" 2> tmp.stats > /dev/null
+grep -q '^phase  *wall(ms)  *cpu(ms)' tmp.stats && grep -q '^total ' tmp.stats ||
+  { echo "--stats => phase table expected"; cat tmp.stats; exit 1; }
+echo "--stats => ok"
+
+# --stats=json: a single object with one entry per phase
+./chibicc --stats=json "$stats" 2> tmp.stats > /dev/null
+[ "$(wc -l < tmp.stats)" -eq 1 ] && grep -q '^{"phases":\[.*\]}$' tmp.stats ||
+  { echo "--stats=json => one JSON object expected"; cat tmp.stats; exit 1; }
+for phase in tokenize parse optimize offsets codegen total; do
+  grep -q "{\"name\":\"$phase\",\"wall_ms\":[0-9.]*,\"cpu_ms\":[0-9.]*,\"tokens\":[0-9]*,\"nodes\":[0-9]*,\"vars\":[0-9]*,\"funcs\":[0-9]*,\"bytes\":[0-9]*,\"peak_rss_kb\":[0-9]*}" tmp.stats ||
+    { echo "--stats=json => no complete entry for $phase"; cat tmp.stats; exit 1; }
+done
+grep -q '"name":"tokenize","wall_ms":[0-9.]*,"cpu_ms":[0-9.]*,"tokens":[1-9]' tmp.stats &&
+  grep -q '"name":"parse","wall_ms":[0-9.]*,"cpu_ms":[0-9.]*,"tokens":[0-9]*,"nodes":[1-9]' tmp.stats ||
+  { echo "--stats=json => tokens and nodes expected"; cat tmp.stats; exit 1; }
+echo "--stats=json => ok"
+
+# --cache-dir
+rm -rf tmp-cache
+cached='int fib(int n) { if (n < 2) { return n; } return fib(n-2) + fib(n-1); } int main() { return fib(10); }'
+./chibicc --cache-dir=tmp-cache "$cached" > tmp.s
+./chibicc --cache-dir=tmp-cache --stats "$cached" > tmp-cached.s 2> tmp.stats
+if cmp -s tmp.s tmp-cached.s && grep -q '^cache: 2 hits, 0 misses' tmp.stats; then
+  echo "--cache-dir => ok"
+else
+  echo "--cache-dir => identical output from 2 cache hits expected"
+  cat tmp.stats
+  exit 1
+fi
+rm -rf tmp-cache
+
+# -jN
+multi='int my_add(int i, int j) { int a = 2; return a + i + j; } int fib(int n) { if (n < 2) { return n; } return fib(n-2) + fib(n-1); } int main() { return fib(10) + my_add(2, 3); }'
+./chibicc "$multi" > tmp.s
+./chibicc -j4 "$multi" > tmp-parallel.s
+if cmp -s tmp.s tmp-parallel.s; then
+  echo "-j4 => ok"
+else
+  echo "-j4 => output identical to the serial front end expected"
+  exit 1
+fi
+
+# --stream
+./chibicc --stream "$multi" > tmp-stream.s
+if cmp -s tmp.s tmp-stream.s; then
+  echo "--stream => ok"
+else
+  echo "--stream => output identical to the whole-program path expected"
+  exit 1
+fi
+
+# --remarks
+./chibicc --remarks=json 'int main() { return ret3(); }' 2>&1 > /dev/null |
+  grep -q '"function":"main","frame_size":0,.*"calls":1,"labels":' ||
+  { echo "--remarks => unexpected report"; exit 1; }
+echo "--remarks => ok"
+
+# --remarks: pushes from memory and one-operand instructions are loads
+./chibicc --remarks 'int main() { int a=12; int b=3; return a/b; }' 2>&1 > /dev/null |
+  grep -q '^main: .*(push/pop 6, loads 2, stores 2,' ||
+  { echo "--remarks => 2 loads and 2 stores expected"; exit 1; }
+echo "--remarks loads/stores => ok"
+
+# instruction selection
+./chibicc 'int main() { int x=3; return x*4+x; }' > tmp.s
+if grep -q 'imul eax, eax, 4' tmp.s && grep -q 'add eax, \[rbp-4\]' tmp.s &&
+   grep -q 'mov dword ptr \[rbp-4\], 3' tmp.s; then
+  echo "isel => ok"
+else
+  echo "isel => immediate and memory operands expected"
+  exit 1
+fi
+
+# -fno-if-convert
+sel='int main() { int x=3; int y; if (x<4) y=5; else y=7; return y; }'
+if ./chibicc "$sel" | grep -q cmove && ! ./chibicc "$sel" | grep -q 'je ' &&
+   ./chibicc -fno-if-convert "$sel" | grep -q 'je '; then
+  echo "-fno-if-convert => ok"
+else
+  echo "-fno-if-convert => cmove with if-conversion and a branch without expected"
+  exit 1
+fi
+
+# -fno-cse
+cse='int main() { int a=3; int b=4; return a*b+a*b; }'
+if [ "$(./chibicc "$cse" | grep -c imul)" = 1 ] &&
+   [ "$(./chibicc -fno-cse "$cse" | grep -c imul)" = 2 ]; then
+  echo "-fno-cse => ok"
+else
+  echo "-fno-cse => one multiplication with CSE and two without expected"
+  exit 1
+fi
 
 echo OK
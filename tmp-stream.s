@@ -0,0 +1,113 @@
+.intel_syntax noprefix
+.global my_add
+my_add:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 16
+  mov [rbp-12], edi
+  mov [rbp-8], esi
+  mov dword ptr [rbp-4], 2
+  push qword ptr [rbp-4]
+  pop rax
+  add eax, [rbp-12]
+  push rax
+  pop rax
+  add eax, [rbp-8]
+  push rax
+  pop rax
+  jmp .Lreturn.my_add
+.Lreturn.my_add:
+  mov rsp, rbp
+  pop rbp
+  ret
+.global fib
+fib:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 8
+  mov [rbp-4], edi
+  push qword ptr [rbp-4]
+  pop rax
+  cmp eax, 2
+  setl al
+  movzb eax, al
+  push rax
+  pop rax
+  cmp eax, 0
+  je  .Lend.fib.0
+  push qword ptr [rbp-4]
+  pop rax
+  jmp .Lreturn.fib
+.Lend.fib.0:
+  push qword ptr [rbp-4]
+  pop rax
+  sub eax, 2
+  push rax
+  mov rax, rsp
+  and rsp, -16
+  sub rsp, 8
+  push rax
+  mov rdi, [rax+0]
+  mov rax, 0
+  call fib
+  pop rsp
+  add rsp, 8
+  push rax
+  push qword ptr [rbp-4]
+  pop rax
+  sub eax, 1
+  push rax
+  mov rax, rsp
+  and rsp, -16
+  sub rsp, 8
+  push rax
+  mov rdi, [rax+0]
+  mov rax, 0
+  call fib
+  pop rsp
+  add rsp, 8
+  push rax
+  pop rdi
+  pop rax
+  add eax, edi
+  push rax
+  pop rax
+  jmp .Lreturn.fib
+.Lreturn.fib:
+  mov rsp, rbp
+  pop rbp
+  ret
+.global main
+main:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 0
+  mov rax, rsp
+  and rsp, -16
+  sub rsp, 8
+  push rax
+  mov edi, 10
+  mov rax, 0
+  call fib
+  pop rsp
+  push rax
+  mov rax, rsp
+  and rsp, -16
+  sub rsp, 8
+  push rax
+  mov edi, 2
+  mov esi, 3
+  mov rax, 0
+  call my_add
+  pop rsp
+  push rax
+  pop rdi
+  pop rax
+  add eax, edi
+  push rax
+  pop rax
+  jmp .Lreturn.main
+.Lreturn.main:
+  mov rsp, rbp
+  pop rbp
+  ret
@@ -0,0 +1,20 @@
+.intel_syntax noprefix
+.global main
+main:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 8
+  mov dword ptr [rbp-4], 3
+  push qword ptr [rbp-4]
+  pop rax
+  imul eax, eax, 4
+  push rax
+  pop rax
+  add eax, [rbp-4]
+  push rax
+  pop rax
+  jmp .Lreturn.main
+.Lreturn.main:
+  mov rsp, rbp
+  pop rbp
+  ret
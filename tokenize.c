@@ -2,11 +2,37 @@
 
 // Input program
 char *user_input;
-// Current token
-Token *token;
+
+// Spellings of keywords and punctuators, indexed by Reserved
+char *reserved[NUM_RESERVED] = {
+  [KW_RETURN] = "return", [KW_IF] = "if",       [KW_ELSE] = "else",
+  [KW_WHILE] = "while",   [KW_FOR] = "for",     [KW_INT] = "int",
+  [PU_EQ] = "==",         [PU_NE] = "!=",       [PU_LE] = "<=",
+  [PU_GE] = ">=",         [PU_ADD] = "+",       [PU_SUB] = "-",
+  [PU_MUL] = "*",         [PU_DIV] = "/",       [PU_LPAREN] = "(",
+  [PU_RPAREN] = ")",      [PU_LT] = "<",        [PU_GT] = ">",
+  [PU_SEMI] = ";",        [PU_ASSIGN] = "=",    [PU_LBRACE] = "{",
+  [PU_RBRACE] = "}",      [PU_COMMA] = ",",     [PU_AMP] = "&",
+};
+
+// Token array and the index of the current token
+_Thread_local Token *tokens;
+_Thread_local uint32_t tokpos;
+
+// Number of tokens in `tokens` and its capacity
+_Thread_local int ntokens;
+_Thread_local int tokens_capa;
+
+// If set, errors jump here instead of being reported. Used by the
+// parallel front end, which redoes a failed parse serially so that
+// diagnostics are exactly those of the serial path.
+_Thread_local jmp_buf *error_jmp;
 
 // Reports an error and exit.
 void error(char *fmt, ...) {
+  if (error_jmp)
+    longjmp(*error_jmp, 1);
+
   va_list ap;
   va_start(ap, fmt);
   vfprintf(stderr, fmt, ap);
@@ -16,6 +42,9 @@ void error(char *fmt, ...) {
 
 // Reports an error location and exit.
 void verror_at(char *loc, char *fmt, va_list ap) {
+  if (error_jmp)
+    longjmp(*error_jmp, 1);
+
   int pos = loc - user_input;
   fprintf(stderr, "%s\n", user_input);
   fprintf(stderr, "%*s", pos, ""); // print pos spaces.
@@ -38,7 +67,9 @@ void error_tok(Token *tok, char *fmt, ...) {
   va_start(ap, fmt);
   if (tok)
     verror_at(tok->str, fmt, ap); // 呼ばれた場合はexitで終了する
-  
+  if (error_jmp)
+    longjmp(*error_jmp, 1);
+
   vfprintf(stderr, fmt, ap);
   fprintf(stderr, "\n");
   exit(1);
@@ -46,75 +77,89 @@ void error_tok(Token *tok, char *fmt, ...) {
 
 char *strndup(char *p, int len) {
   char *buf = malloc(len + 1);
+  stats.bytes += len + 1;
   strncpy(buf, p, len);
   buf[len] = '\0';
   return buf;
 }
 
-// Consumes the current token if it matches `op`.
-Token *consume(char *op) {
-  if (token->kind != TK_RESERVED || strlen(op) != token->len ||
-      memcmp(token->str, op, token->len))
+// Returns the current token.
+Token *peek() {
+  return &tokens[tokpos];
+}
+
+// Consumes the current token if it is the keyword or punctuator `id`.
+Token *consume(Reserved id) {
+  Token *t = &tokens[tokpos];
+  if (t->kind != TK_RESERVED || t->id != id)
     return NULL;
-  Token *t = token;
-  token = token->next;
+  tokpos++;
   return t;
 }
 
 // Consumes the current token if it is an identifier.
 Token *consume_ident() {
-  if (token->kind != TK_IDENT)
+  Token *t = &tokens[tokpos];
+  if (t->kind != TK_IDENT)
     return NULL;
-  Token *t = token;
-  token = token->next;
+  tokpos++;
   return t;
 }
 
-// Ensure that the current token is `op`.
-void expect(char *op) {
-  if (token->kind != TK_RESERVED || strlen(op) != token->len ||
-      memcmp(token->str, op, token->len))
-    error_tok(token, "expected \"%s\"", op);
-  token = token->next;
+// Ensure that the current token is the keyword or punctuator `id`.
+void expect(Reserved id) {
+  Token *t = &tokens[tokpos];
+  if (t->kind != TK_RESERVED || t->id != id)
+    error_tok(t, "expected \"%s\"", reserved[id]);
+  tokpos++;
 }
 
 // Ensure that the current token is TK_NUM.
 int expect_number() {
-  if (token->kind != TK_NUM)
-    error_tok(token, "expected a number");
-  int val = token->val;
-  token = token->next;
-  return val;
+  Token *t = &tokens[tokpos];
+  if (t->kind != TK_NUM)
+    error_tok(t, "expected a number");
+  tokpos++;
+  return t->val;
 }
 
 // Ensure that the current token is TK_IDENT.
 char *expect_ident() {
-  if (token->kind != TK_IDENT)
-    error_tok(token, "expected an identifier");
-  char *s = strndup(token->str, token->len);
-  token = token->next;
-  return s;
+  Token *t = &tokens[tokpos];
+  if (t->kind != TK_IDENT)
+    error_tok(t, "expected an identifier");
+  tokpos++;
+  return strndup(t->str, t->len);
 }
 
 Token *expect_ident_tok() {
-  if (token->kind != TK_IDENT)
-    error_tok(token, "expected an identifier");
-  Token *t = token;
-  token = token->next;
+  Token *t = &tokens[tokpos];
+  if (t->kind != TK_IDENT)
+    error_tok(t, "expected an identifier");
+  tokpos++;
   return t;
 }
 
 bool at_eof() {
-  return token->kind == TK_EOF;
+  return tokens[tokpos].kind == TK_EOF;
 }
 
-// Create a new token and add it as the next token of `cur`.
-Token *new_token(TokenKind kind, Token *cur, char *str, int len) {
-  Token *tok = calloc(1, sizeof(Token)); // MEMO: callocしているのはゼロクリアするため (nextをNULLポインタにする)
+// Append a new token to `tokens`. The array grows geometrically, so
+// tokenizing takes only a handful of reallocs.
+Token *new_token(TokenKind kind, char *str, int len) {
+  if (ntokens == tokens_capa) {
+    int capa = tokens_capa ? tokens_capa * 2 : 256;
+    tokens = realloc(tokens, capa * sizeof(Token));
+    stats.bytes += (capa - tokens_capa) * sizeof(Token);
+    tokens_capa = capa;
+  }
+
+  Token *tok = &tokens[ntokens++];
+  stats.tokens++;
   tok->kind = kind;
   tok->str = str;
   tok->len = len;
-  cur->next = tok;
+  tok->val = 0;
   return tok;
 }
 
@@ -130,76 +175,77 @@ bool is_alnum(char c) {
   return is_alpha(c) || ('0' <= c && c <= '9');
 }
 
-char *starts_with_reserved(char *p) {
-  // Keyword
-  static char *kw[] = {"return", "if", "else", "while", "for", "int"};
+// Returns the length of the identifier starting at `p`.
+int ident_len(char *p) {
+  char *q = p;
+  while (is_alnum(*q))
+    q++;
+  return q - p;
+}
 
-  for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++) {
-    int len = strlen(kw[i]);
-    if (startswith(p, kw[i]) && !is_alnum(p[len]))
-      return kw[i];
+// Returns the id of the keyword or punctuator at `p`, or -1.
+// Keywords come first in Reserved, then multi-letter punctuators, so
+// the first match is the longest one.
+int read_reserved(char *p) {
+  for (int i = 0; i < NUM_RESERVED; i++) {
+    if (*p != reserved[i][0] || !startswith(p, reserved[i]))
+      continue;
+    int len = strlen(reserved[i]);
+    if (i <= KW_INT && is_alnum(p[len]))
+      continue;
+    return i;
   }
-
-  // Multi-letter punctuator
-  static char *ops[] = {"==", "!=", "<=", ">="};
-
-  for (int i = 0; i < sizeof(ops) / sizeof(*ops); i++)
-    if (startswith(p, ops[i]))
-      return ops[i];
-
-  return NULL;
+  return -1;
 }
 
 // Tokenize `user_input` and returns new tokens.
 Token *tokenize() {
-  char *p = user_input;
-  Token head;
-  head.next = NULL;
-  Token *cur = &head;
+  return tokenize_range(user_input, user_input + strlen(user_input));
+}
 
-  while (*p) {
+// Tokenize the part of `user_input` between `p` and `end`. The token
+// array is reused, so tokens from a previous call become invalid.
+Token *tokenize_range(char *p, char *end) {
+  ntokens = 0;
+  tokpos = 0;
+
+  while (p < end) {
     // Skip whitespace characters.
     if (isspace(*p)) {
       p++;
       continue;
     }
 
-    // Keyword or multi-letter punctuator
-    char *kw = starts_with_reserved(p);
-    if (kw) {
-      int len = strlen(kw);
-      cur = new_token(TK_RESERVED, cur, p, len);
+    // Keyword or punctuator
+    int id = read_reserved(p);
+    if (id >= 0) {
+      int len = strlen(reserved[id]);
+      new_token(TK_RESERVED, p, len)->id = id;
       p += len;
       continue;
     }
 
-    // Single-letter punctuator
-    if (strchr("+-*/()<>;={},&", *p)) {
-      cur = new_token(TK_RESERVED, cur, p++, 1);
-      continue;
-    }
-
     // Identifier
     if (is_alpha(*p)) {
       char *q = p++;
       while (is_alnum(*p))
         p++;
-      cur = new_token(TK_IDENT, cur, q, p - q);
+      new_token(TK_IDENT, q, p - q);
       continue;
     }
 
     // Integer literal
     if (isdigit(*p)) {
-      cur = new_token(TK_NUM, cur, p, 0);
+      Token *tok = new_token(TK_NUM, p, 0);
       char *q = p;
-      cur->val = strtol(p, &p, 10);
-      cur->len = p - q;
+      tok->val = strtol(p, &p, 10);
+      tok->len = p - q;
       continue;
     }
 
     error_at(p, "invalid token");
   }
 
-  new_token(TK_EOF, cur, p, 0);
-  return head.next;
+  new_token(TK_EOF, p, 0);
+  return tokens;
 }
@@ -0,0 +1,25 @@
+#include "chibicc.h"
+
+// Types are small integers so that a Node can carry one in its padding
+// and any thread can make new ones without locking. int is the only
+// base type, so a type is its pointer depth: TY_INT is int, TY_INT + 1
+// is int*, and so on.
+
+bool is_pointer(TypeId ty) {
+  return ty > TY_INT;
+}
+
+TypeId pointer_to(TypeId base) {
+  if (base == UINT16_MAX)
+    error("too many levels of pointers");
+  return base + 1;
+}
+
+// The type a pointer points to.
+TypeId base_type(TypeId ty) {
+  return ty - 1;
+}
+
+int size_of(TypeId ty) {
+  return is_pointer(ty) ? 8 : 4;
+}